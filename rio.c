@@ -8,6 +8,7 @@
 #include <frame.h>
 #include <fcall.h>
 #include <plumb.h>
+#include <pool.h>
 #include "dat.h"
 #include "fns.h"
 
@@ -33,6 +34,7 @@ Image*	drag(Window*, Rectangle*);
 void		refresh(Rectangle);
 void		resized(void);
 Channel	*exitchan;	/* chan(int) */
+int		exitfd[2];	/* shutdown writes here for exitproc */
 Channel	*winclosechan; /* chan(Window*); */
 Channel *kbdchan;	/* chan(char*); */
 Rectangle	viewr;
@@ -42,10 +44,111 @@ void	mousethread(void*);
 void	keyboardthread(void*);
 void winclosethread(void*);
 void deletethread(void*);
+void	trimthread(void*);
+void	pastetrim(Window*, uint);
 void	initcmd(void*);
 Channel* initkbd(void);
+Channel* kbdwait(Channel*);
+void	phase(int);
+void	kbdbatch(char*);
+int	wheelticks(Mouse*, int*);
+void	wheelscroll(Window*, int, int);
+void	wmflush(void);
+void	menu3items(void);
+void	benchthread(void*);
+void	churnthread(void*);
+void	wacct(Window*, int);
+void	acctdrop(int);
+void	acctprune(void);
+void	acctcmd(Window*, char*, char**);
+void	sesssave(char*);
+void	exitproc(void*);
+void	evinit(char*);
+void	restorethread(void*);
+long	proccputime(int);
+char*	wmtracectl(char*);
+void	wmtracedump(void);
+void	overview(void);
+int	outlinedue(void);
+void	drawborder(Rectangle, int);
+void	statbytes(int, uvlong);
+void	fontwarm(void*);
+Channel	*overviewc;	/* keys for the overview while it's up */
+void	wmevent(char*, ...);
+void	focuscheck(void);
+void	recordinit(char*);
+void	record(char*, ...);
+void	recordkbd(char*);
+void	replayproc(void*);
+void	kbdstamp(void);
+vlong	kbdunstamp(void);
+Image*	wmwindow(Rectangle, int);
+Image*	wmimage(Rectangle, ulong);
+ulong	thumbhit, thumbmiss;
+void	wmsendctl(Window*, int, Rectangle, Image*);
+vlong	tracestart(void);
+void	trace(char*, vlong, int, int);
+char*	wmtrace(int*);
+char*	wmtracectl(char*);
+void	statadd(int, vlong);
+char*	wmstats(int*);
+char*	kbdrunes(char*, int);
+
+typedef struct Layout Layout;
+struct Layout
+{
+	Window	*w;
+	Rectangle	r;
+	int		hide;
+};
+
+void	applylayout(Layout*, int);
+int	ishidden(Window*);
+Window*	wfindid(int);
+int	windex(int);
+void	wregadd(Window*);
 
 char		*fontname;
+int		scrollback;	/* runes kept per window; 0 leaves it to HiWater */
+int		benchn;		/* -B: run the benchmarks up to this many windows */
+int		churnn;		/* -C: create and delete this many windows */
+char		*recfile;	/* -r: record input here */
+char		*replayfile;	/* -p, -P: replay input from here */
+int		replayfast;
+char		*sessfile;	/* -S: restore the session from here, save it on exit */
+int		lowbw;		/* -L: spare the link to the draw server */
+char		*tracefile;	/* -t: trace from the start, write the spans here on exit */
+char		*evfile;	/* -e: write the event stream here as it happens */
+int		tiled;		/* the visible windows are as tile() left them */
+int		tiling;		/* tile() is applying its layout */
+Window		*unhiding;	/* hidden, but to be laid out with the visible */
+int		wregn;		/* nwindow the registry was built for, -1 if stale */
+
+typedef struct Region Region;
+struct Region
+{
+	char		*name;
+	Rectangle	pct;	/* of the screen, in percent */
+	int		*id;	/* the windows in it */
+	int		nid;
+	int		tiled;	/* as tilein() left it */
+};
+
+Region	*regions;
+int	nregion;
+int	curregion;	/* where new windows go */
+
+void	tilein(Region*);
+Region*	regionof(int);
+void	regionadd(Region*, int);
+void	regiondel(Region*, int);
+void	regionclaim(void);
+Rectangle	regionrect(Region*);
+int	tileable(Window*);
+int	istiled(Window*);
+void	retile(Window*);
+void	untile(Window*);
+char*	wmregion(char*);
 
 enum
 {
@@ -55,6 +158,7 @@ enum
 	Delete,
 	Hide,
 	Tile,
+	Overview,
 	Exit,
 };
 
@@ -66,6 +170,7 @@ enum
 	Plumb,
 	Send,
 	Scroll,
+	Stop,
 };
 
 char		*menu2str[] = {
@@ -75,6 +180,7 @@ char		*menu2str[] = {
  [Plumb]		"plumb",
  [Send]		"send",
  [Scroll]		"scroll",
+ [Stop]		nil,		/* "stop" while a paste is streaming */
 			nil
 };
 
@@ -92,6 +198,7 @@ char		*menu3str[100] = {
  [Delete]		"Delete",
  [Hide]		"Hide",
  [Tile]		"Tile",
+ [Overview]	"Overview",
  [Exit]		"Exit",
 			nil
 };
@@ -101,6 +208,49 @@ Menu menu3 =
 	menu3str
 };
 
+/* stats kept for /dev/wmstats */
+enum
+{
+	Stile,
+	Sresized,
+	Smenu3,
+	Sobscured,
+	Ssweep,
+	Sdrag,
+	Snew,
+	Sspawn,
+	Sflush,
+	Sallocwindow,
+	Sallocimage,
+	Smouse,
+	Skbd,
+	Skbdqueue,	/* kbdproc or /dev/kbdin to keyboardthread */
+	Skbdsend,	/* keyboardthread to the window's ck */
+	Smousesend,	/* mousethread to the window's mc.c */
+	Srestore,
+	NSTAT,
+};
+int	recfd = -1;
+uvlong	drawbytes;	/* sent to the draw server by wmflush */
+
+/* startup, in the order threadmain goes through it */
+enum
+{
+	Pfont,		/* starting kbdproc, font check */
+	Pdraw,		/* geninitdraw */
+	Picons,
+	Pmouse,
+	Pscreen,	/* allocscreen and the first frame */
+	Pkbd,		/* what's left of waiting for kbdproc */
+	Pfsys,		/* threads and the file server */
+	Pwarm,		/* fontwarm, after the rest */
+	NPHASE,
+};
+
+vlong	phases[NPHASE];
+vlong	startt, phaset;
+vlong	statread;	/* nsec of the previous wmstats read, or of startup */
+
 char *rcargv[] = { "rc", "-i", nil };
 char *kbdargv[] = { "rc", "-c", nil, nil };
 
@@ -115,7 +265,7 @@ derror(Display*, char *errorstr)
 void
 usage(void)
 {
-	fprint(2, "usage: rio [-b] [-f font] [-i initcmd] [-k kbdcmd] [-s]\n");
+	fprint(2, "usage: rio [-b] [-f font] [-i initcmd] [-B nwindow] [-C nchurn] [-c scrollback] [-k kbdcmd] [-r recfile] [-p|-P replayfile] [-s] [-L] [-t tracefile] [-e eventfile] [-R 'name minx miny maxx maxy'] [-S session]\n");
 	exits("usage");
 }
 
@@ -135,6 +285,7 @@ threadmain(int argc, char *argv[])
 	initstr = nil;
 	kbdin = nil;
 	maxtab = 0;
+	quotefmtinstall();	/* for the session file */
 	ARGBEGIN{
 	case 'b':
 		reverse = ~0xFF;
@@ -156,9 +307,67 @@ threadmain(int argc, char *argv[])
 		if(kbdin == nil)
 			usage();
 		break;
+	case 'B':
+		s = ARGF();
+		if(s == nil)
+			usage();
+		benchn = strtol(s, nil, 0);
+		break;
+	case 'C':
+		s = ARGF();
+		if(s == nil)
+			usage();
+		churnn = strtol(s, nil, 0);
+		break;
+	case 'c':
+		s = ARGF();
+		if(s == nil)
+			usage();
+		scrollback = strtol(s, nil, 0);
+		break;
+	case 'r':
+		recfile = ARGF();
+		if(recfile == nil)
+			usage();
+		break;
+	case 'P':
+		replayfast = TRUE;
+		/* fall through */
+	case 'p':
+		replayfile = ARGF();
+		if(replayfile == nil)
+			usage();
+		break;
 	case 's':
 		scrolling = TRUE;
 		break;
+	case 'L':
+		lowbw = TRUE;
+		break;
+	case 't':
+		tracefile = ARGF();
+		if(tracefile == nil)
+			usage();
+		break;
+	case 'e':
+		evfile = ARGF();
+		if(evfile == nil)
+			usage();
+		break;
+	case 'R':
+		s = ARGF();
+		if(s == nil)
+			usage();
+		s = smprint("region %s", s);
+		if(wmregion(s) != nil)
+			usage();
+		free(s);
+		break;
+	case 'S':
+		sessfile = ARGF();
+		if(sessfile == nil)
+			usage();
+		break;
 	}ARGEND
 
 	if(getwd(buf, sizeof buf) == nil)
@@ -174,37 +383,57 @@ threadmain(int argc, char *argv[])
 		maxtab = 4;
 	free(s);
 
+	startt = nsec();
+	statread = startt;
+	if(tracefile)
+		wmtracectl("on");
+	phaset = startt;
+	/*
+	 * kbdproc opens its files while the display comes up; from
+	 * here on leave by threadexitsall, so that it goes too and
+	 * the console isn't left raw.
+	 */
+	kbdchan = initkbd();
 	if(fontname){
 		/* check font before barging ahead */
 		if(access(fontname, 0) < 0){
 			fprint(2, "rio: can't access %s: %r\n", fontname);
-			exits("font open");
+			threadexitsall("font open");
 		}
 		putenv("font", fontname);
 	}
-
-	snarffd = open("/dev/snarf", OREAD|OCEXEC);
-	gotscreen = access("/dev/screen", AEXIST)==0;
+	phase(Pfont);
 
 	if(geninitdraw(nil, derror, nil, "rio", nil, Refnone) < 0){
 		fprint(2, "rio: can't open display: %r\n");
-		exits("display open");
+		threadexitsall("display open");
 	}
+	phase(Pdraw);
 	iconinit();
+	phase(Picons);
 	view = screen;
 	viewr = view->r;
 	mousectl = initmouse(nil, screen);
 	if(mousectl == nil)
 		error("can't find mouse");
 	mouse = mousectl;
-	kbdchan = initkbd();
-	if(kbdchan == nil)
-		error("can't find keyboard");
+	if(recfile)
+		recordinit(recfile);
+	phase(Pmouse);
 	wscreen = allocscreen(screen, background, 0);
 	if(wscreen == nil)
 		error("can't allocate screen");
 	draw(view, viewr, background, nil, ZP);
-	flushimage(display, 1);
+	wmflush();
+	phase(Pscreen);
+	kbdchan = kbdwait(kbdchan);
+	if(kbdchan == nil)
+		error("can't find keyboard");
+	phase(Pkbd);
+
+	/* not needed for the first frame */
+	snarffd = open("/dev/snarf", OREAD|OCEXEC);
+	gotscreen = access("/dev/screen", AEXIST)==0;
 
 	exitchan = chancreate(sizeof(int), 0);
 	winclosechan = chancreate(sizeof(Window*), 0);
@@ -215,31 +444,73 @@ threadmain(int argc, char *argv[])
 	threadcreate(mousethread, nil, STACK);
 	threadcreate(winclosethread, nil, STACK);
 	threadcreate(deletethread, nil, STACK);
+	if(scrollback > 0)
+		threadcreate(trimthread, nil, STACK);
+	threadcreate(fontwarm, nil, STACK);
 	filsys = filsysinit(xfidinit());
+	phase(Pfsys);
 
 	if(filsys == nil)
 		fprint(2, "rio: can't create file system server: %r\n");
 	else{
 		errorshouldabort = 1;	/* suicide if there's trouble after this */
+		if(evfile)
+			evinit(evfile);
 		if(initstr)
 			proccreate(initcmd, initstr, STACK);
+		if(benchn > 0)
+			threadcreate(benchthread, nil, STACK);
+		else if(churnn > 0)
+			threadcreate(churnthread, nil, STACK);
+		if(replayfile)
+			proccreate(replayproc, replayfile, STACK);
+		if(sessfile)
+			threadcreate(restorethread, sessfile, STACK);
 		if(kbdin){
 			kbdargv[2] = kbdin;
 			r = screen->r;
 			r.max.x = r.min.x+300;
 			r.max.y = r.min.y+80;
-			i = allocwindow(wscreen, r, Refbackup, DNofill);
+			i = wmwindow(r, Refbackup);
 			wkeyboard = new(i, FALSE, scrolling, 0, nil, "/bin/rc", kbdargv);
 			if(wkeyboard == nil)
 				error("can't create keyboard window");
 		}
+		if(pipe(exitfd) < 0)
+			error("can't make exit pipe");
+		proccreate(exitproc, nil, STACK);
 		threadnotify(shutdown, 1);
 		recv(exitchan, nil);
+		if(sessfile)
+			sesssave(sessfile);
+		wmtracedump();
 	}
 	killprocs();
 	threadexitsall(nil);
 }
 
+/*
+ * The snarf cache: snarf[] holds the contents of /dev/snarf as of
+ * the version recorded here.  Servers that don't version the file
+ * (vers 0) are always re-read.
+ */
+Qid	snarfqid;
+int	snarfcached;
+
+enum
+{
+	/* runerealloc's size is a uint */
+	Snarfmax	= 0xFFFFFFFFU/sizeof(Rune) - 1,
+};
+
+void
+snarfstamp(Dir *d)
+{
+	snarfcached = d!=nil && d->qid.vers!=0;
+	if(snarfcached)
+		snarfqid = d->qid;
+}
+
 /*
  * /dev/snarf updates when the file is closed, so we must open our own
  * fd here rather than use snarffd
@@ -248,45 +519,70 @@ void
 putsnarf(void)
 {
 	int fd, i, n;
+	char buf[8192+UTFmax];
+	Dir *d;
 
 	if(snarffd<0 || nsnarf==0)
 		return;
 	fd = open("/dev/snarf", OWRITE);
 	if(fd < 0)
 		return;
-	/* snarf buffer could be huge, so fprint will truncate; do it in blocks */
-	for(i=0; i<nsnarf; i+=n){
-		n = nsnarf-i;
-		if(n >= 256)
-			n = 256;
-		if(fprint(fd, "%.*S", n, snarf+i) < 0)
-			break;
+	/* snarf buffer could be huge; write it in large blocks */
+	n = 0;
+	for(i=0; i<nsnarf; i++){
+		n += runetochar(buf+n, &snarf[i]);
+		if(n >= sizeof buf-UTFmax){
+			if(write(fd, buf, n) != n)
+				break;
+			n = 0;
+		}
 	}
+	if(i == nsnarf && n > 0)
+		write(fd, buf, n);
 	close(fd);
+	/* snarf[] already holds what we wrote */
+	d = dirfstat(snarffd);
+	snarfstamp(d);
+	free(d);
 }
 
 void
 getsnarf(void)
 {
-	int i, n, nb, nulls;
-	char *sn, buf[1024];
+	int i, n, m, nb, nulls;
+	char *sn;
+	Dir *d;
 
 	if(snarffd < 0)
 		return;
-	sn = nil;
+	m = 8192;
+	if((d = dirfstat(snarffd)) != nil){
+		if(snarfcached && d->qid.vers != 0)
+		if(d->qid.path == snarfqid.path && d->qid.vers == snarfqid.vers){
+			free(d);
+			return;
+		}
+		if(d->length > 0 && d->length < 0x7FFFFFFF-1)
+			m = d->length+1;
+	}
+	sn = emalloc(m+1);
 	i = 0;
 	seek(snarffd, 0, 0);
-	while((n = read(snarffd, buf, sizeof buf)) > 0){
-		sn = erealloc(sn, i+n+1);
-		memmove(sn+i, buf, n);
+	while((n = read(snarffd, sn+i, m-i)) > 0){
 		i += n;
-		sn[i] = 0;
+		if(i == m){
+			m *= 2;
+			sn = erealloc(sn, m+1);
+		}
 	}
-	if(i > 0){
+	if(i > 0 && i < Snarfmax){
 		snarf = runerealloc(snarf, i+1);
 		cvttorunes(sn, i, snarf, &nb, &nsnarf, &nulls);
-		free(sn);
 	}
+	free(sn);
+	/* stamped with the version seen before reading; a racing write just misses the cache */
+	snarfstamp(d);
+	free(d);
 }
 
 void
@@ -310,24 +606,42 @@ char *oknotes[] =
 	nil
 };
 
+/*
+ * The note goes to every proc, any of which may be in the middle
+ * of malloc or of changing window[], so nothing is done here but
+ * to wake exitproc; threadmain saves the session and exits.
+ */
 int
 shutdown(void *, char *msg)
 {
 	int i;
-	static Lock shutdownlk;
+	static long noted;
 	
-	killprocs();
 	for(i=0; oknotes[i]; i++)
 		if(strncmp(oknotes[i], msg, strlen(oknotes[i])) == 0){
-			lock(&shutdownlk);	/* only one can threadexitsall */
-			threadexitsall(msg);
+			if(ainc(&noted) == 1)
+				write(exitfd[1], msg, strlen(msg));
+			return 1;
 		}
+	killprocs();
 	fprint(2, "rio %d: abort: %s\n", getpid(), msg);
 	abort();
 	exits(msg);
 	return 0;
 }
 
+void
+exitproc(void*)
+{
+	char buf[ERRMAX];
+
+	threadsetname("exitproc");
+	/* the note interrupts the read before it has been written */
+	while(read(exitfd[0], buf, sizeof buf) < 0)
+		;
+	send(exitchan, nil);
+}
+
 void
 killprocs(void)
 {
@@ -338,59 +652,63 @@ killprocs(void)
 			write(window[i]->notefd, "hangup", 6); 
 }
 
+void focuswindow(Window *w) {
+  incref(w);
+  wtopme(w);
+  wcurrent(w);
+  wclose(w);
+}
+
 void movewindowforward(void) { 
-  Window *w;
   int i;
-  for(i = 0; i <= nwindow; i++) {
-    if(window[i] == input) {
-      if (i >= nwindow - 1) {
-        w = window[0];
-        incref(w);
-        wtopme(w);
-        wcurrent(w);
-        wclose(w);
-      } else {
-        w = window[i+1];
-        incref(w);
-        wtopme(w);
-        wcurrent(w);
-        wclose(w);
-      }
-    }
+  if(input == nil || (i = windex(input->id)) < 0)
+    return;
+  if (i >= nwindow - 1) {
+    focuswindow(window[0]);
+  } else {
+    focuswindow(window[i+1]);
   }
 }
 
 void movewindowbackwards(void) {
-  Window *w;
   int i;
-  for(i = 0; i <= nwindow; i++) {
-    if(window[i] == input) {
-      if (i == 0 ) {
-        w = window[nwindow - 1];
-        incref(w);
-        wtopme(w);
-        wcurrent(w);
-        wclose(w);
-      } else {
-        w = window[i-1];
-        incref(w);
-        wtopme(w);
-        wcurrent(w);
-        wclose(w);
-      }
-    }
+  if(input == nil || (i = windex(input->id)) < 0)
+    return;
+  if (i == 0 ) {
+    focuswindow(window[nwindow - 1]);
+  } else {
+    focuswindow(window[i-1]);
   }
-
 }
 
 void
 keyboardthread(void*)
 {
+	Window *w;
 	char *s;
+	vlong t0;
+
 	threadsetname("keyboardthread");
 	while(s = recvp(kbdchan)){
+		statadd(Skbd, 0);
+		focuscheck();
+		if(recfd >= 0)
+			recordkbd(s);
+		t0 = kbdunstamp();
+		if(t0)
+			statadd(Skbdqueue, t0);
+		t0 = nsec();
     // print("s1: 0x%hhux, s2: 0x%hhux, s3: 0x%hhux, s4: 0x%hhux, s5: 0x%hhux\n", s[1], s[2], s[3], s[4], s[5]);
     // print("%s\n", s);
+		if(overviewc != nil){
+			if(*s != 'c' || nbsendp(overviewc, s) <= 0)
+				free(s);
+			continue;
+		}
+		if(*s == 'c' && utflen(s+1) > 1){
+			kbdbatch(s);
+			continue;
+		}
 		if(*s == 'k' || *s == 'K')
 		    shiftdown = utfrune(s+1, Kshift) != nil;
 		    ctrldown = utfrune(s+1, Kctl) != nil;
@@ -405,19 +723,76 @@ keyboardthread(void*)
 			r = screen->r;
 			r.max.x = r.min.x+300;
 			r.max.y = r.min.y+80;
-			i = allocwindow(wscreen, r, Refbackup, DNofill);
-			new(i, FALSE, scrolling, 0, nil, "/bin/rc", nil);
-
-      tile();
+			i = wmwindow(r, Refbackup);
+			if((w = new(i, FALSE, scrolling, 0, nil, "/bin/rc", nil)) != nil)
+				retile(w);
     } else if (shiftdown && s[1] == (char)0x20 && s[2] == (char)0x0) {
 		  tile();
 
 		} else {
 			if(input == nil || sendp(input->ck, s) <= 0)
 		    	free(s);
+			else
+				statadd(Skbdsend, t0);
+		}
+
+	}
+}
+
+/*
+ * A 'c' message may carry a run of runes, as queued by keyboardsend
+ * and kbdproc so that bulk input crosses kbdchan once.  Windows
+ * expect one rune per message, so split it here, in order.
+ */
+void
+kbdbatch(char *s)
+{
+	char *p, *m;
+	Rune r;
+
+	for(p=s+1; *p && input!=nil; ){
+		p += chartorune(&r, p);
+		if(r == 0)
+			continue;
+		m = smprint("c%C", r);
+		if(sendp(input->ck, m) <= 0){
+			free(m);
+			break;
 		}
+	}
+	free(s);
+}
 
+/*
+ * Convert n bytes of UTF from s into a single 'c' message,
+ * dropping NULs.  Returns nil if nothing is left to send.
+ */
+char*
+kbdrunes(char *s, int n)
+{
+	char *b, *p;
+	Rune r;
+	int i, w;
+
+	b = emalloc(1+n*UTFmax+1);
+	p = b;
+	*p++ = 'c';
+	for(i=0; i<n; i+=w){
+		if(fullrune(s+i, n-i))
+			w = chartorune(&r, s+i);
+		else{
+			r = Runeerror;
+			w = n-i;
+		}
+		if(r)
+			p += runetochar(p, &r);
 	}
+	*p = 0;
+	if(p == b+1){
+		free(b);
+		return nil;
+	}
+	return b;
 }
 
 /*
@@ -426,21 +801,17 @@ keyboardthread(void*)
 void
 keyboardsend(char *s, int cnt)
 {
+	char *b;
+
 	if(cnt <= 0)
 		return;
-	if(s[cnt-1] == 0)
+	if(s[cnt-1] == 0){
+		kbdstamp();
 		chanprint(kbdchan, "%s", s);
-	else {
-		Rune *r;
-		int i, nb, nr;
-
-		r = runemalloc(cnt);
-		cvttorunes(s, cnt, r, &nb, &nr, nil);
-		for(i=0; i<nr; i++){
-			if(r[i])
-				chanprint(kbdchan, "c%C", r[i]);
-		}
-		free(r);
+	}else if((b = kbdrunes(s, cnt)) != nil){
+		kbdstamp();
+		if(sendp(kbdchan, b) <= 0)
+			free(b);
 	}
 }
 
@@ -480,11 +851,21 @@ void
 winclosethread(void*)
 {
 	Window *w;
+	Region *g;
+	int id;
 
 	threadsetname("winclosethread");
 	for(;;){
 		w = recvp(winclosechan);
+		id = w->id;
+		g = regionof(id);
 		wclose(w);
+		/* gone from a tiled region: close the gap */
+		if(g!=nil && wfindid(id)==nil){
+			regiondel(g, id);
+			if(g->tiled)
+				tilein(g);
+		}
 	}
 }
 
@@ -508,6 +889,55 @@ deletethread(void*)
 	}
 }
 
+/*
+ * Drop text from the head of w down to 3/4 of the scrollback cap,
+ * at a line boundary, never touching what is on screen or not yet
+ * read by the client.  Trimming in bulk keeps the memmove in
+ * wdelete to once per quarter-cap of output.
+ */
+int
+wtrim(Window *w)
+{
+	uint n, lim;
+
+	if(w->deleted || w->nr <= scrollback)
+		return 0;
+	lim = w->org;
+	if(w->qh < lim)
+		lim = w->qh;
+	n = w->nr - scrollback*3/4;
+	if(n > lim)
+		n = lim;
+	while(n < lim && w->r[n-1] != '\n')
+		n++;
+	if(n == 0)
+		return 0;
+	wdelete(w, 0, n);
+	pastetrim(w, n);
+	wscrdraw(w);
+	return 1;
+}
+
+/* thread to hold windows to the -c scrollback cap */
+void
+trimthread(void*)
+{
+	Timer *t;
+	int i, n;
+
+	threadsetname("trimthread");
+	for(;;){
+		t = timerstart(500);
+		recv(t->c, nil);
+		timerstop(t);
+		n = 0;
+		for(i=0; i<nwindow; i++)
+			n += wtrim(window[i]);
+		if(n)
+			wmflush();
+	}
+}
+
 void
 deletetimeoutproc(void *v)
 {
@@ -537,16 +967,18 @@ keyboardhide(void)
 void
 mousethread(void*)
 {
-	int sending, inside, scrolling, moving, band;
-	Window *w, *winput;
+	int sending, inside, scrolling, moving, band, pending, n;
+	vlong t0;
+	Window *w, *winput, *curw;
 	Image *i;
 	Rectangle r;
 	Point xy;
-	Mouse tmp;
+	Mouse tmp, next[2];
 	enum {
 		MReshape,
 		MMouse,
-		NALT
+		NALT,
+		MPending,	/* an event read ahead while coalescing */
 	};
 	static Alt alts[NALT+1];
 
@@ -554,6 +986,8 @@ mousethread(void*)
 	sending = FALSE;
 	scrolling = FALSE;
 	moving = FALSE;
+	pending = 0;
+	curw = nil;
 
 	alts[MReshape].c = mousectl->resizec;
 	alts[MReshape].v = nil;
@@ -564,15 +998,32 @@ mousethread(void*)
 	alts[NALT].op = CHANEND;
 
 	for(;;)
-	    switch(alt(alts)){
+	    switch(pending>0 ? MPending : alt(alts)){
 		case MReshape:
+			record("r %lld\n", nsec());
 			resized();
 			break;
+		case MPending:
+			mousectl->Mouse = next[0];
+			next[0] = next[1];
+			pending--;
+			/* fall through */
 		case MMouse:
+			statadd(Smouse, 0);
+			focuscheck();
+			t0 = nsec();
 			if(wkeyboard!=nil && (mouse->buttons & (1<<5))){
 				keyboardhide();
 				break;
 			}
+			/* with no buttons down, only the latest position matters */
+			while(!pending && mouse->buttons == 0 && nbrecv(mousectl->c, &next[0]) > 0){
+				if(next[0].buttons != 0){
+					pending = 1;
+					break;
+				}
+				mousectl->Mouse = next[0];
+			}
 		Again:
 			winput = input;
 			/* override everything for the keyboard window */
@@ -587,7 +1038,13 @@ mousethread(void*)
 				xy.y = mouse->xy.y + (winput->i->r.min.y-winput->screenr.min.y);
 
 				/* the up and down scroll buttons are not subject to the usual rules */
-				if((mouse->buttons&(8|16)) && !winput->mouseopen)
+				if((mouse->buttons&(8|16)) && !winput->mouseopen){
+					n = wheelticks(next, &pending);
+					wheelscroll(winput, mouse->buttons, n);
+					curw = nil;
+					continue;
+				}
+				if(mouse->buttons&(8|16))
 					goto Sending;
 
 				inside = ptinrect(mouse->xy, insetrect(winput->screenr, Selborder));
@@ -602,18 +1059,25 @@ mousethread(void*)
 					moving = TRUE;
 				}else if(inside && (scrolling || winput->mouseopen || (mouse->buttons&1)))
 					sending = TRUE;
-			}else
+			}else{
 				sending = FALSE;
+				curw = nil;
+			}
 			if(sending){
 			Sending:
 				if(mouse->buttons == 0){
 					cornercursor(winput, mouse->xy, 0);
 					sending = FALSE;
-				}else
+					curw = nil;
+				}else if(curw != winput){
+					/* the cursor can't change under a held button */
 					wsetcursor(winput, 0);
+					curw = winput;
+				}
 				tmp = mousectl->Mouse;
 				tmp.xy = xy;
 				send(winput->mc.c, &tmp);
+				statadd(Smousesend, t0);
 				continue;
 			}
 			w = wpointto(mouse->xy);
@@ -633,9 +1097,9 @@ mousethread(void*)
 				sweeping = 0;
 				if(i != nil){
 					if(band)
-						wsendctlmesg(winput, Reshaped, i->r, i);
+						wmsendctl(winput, Reshaped, i->r, i);
 					else
-						wsendctlmesg(winput, Moved, r, i);
+						wmsendctl(winput, Moved, r, i);
 					cornercursor(winput, mouse->xy, 1);
 				}
 				if(wclose(winput) == 0)
@@ -679,6 +1143,66 @@ mousethread(void*)
 		}
 }
 
+/*
+ * Swallow the wheel ticks queued behind the current one,
+ * returning how many to scroll by.  What ends the run, a
+ * release and whatever follows it, is left in next[] for the
+ * mouse thread to handle in order; *pending counts them.
+ */
+int
+wheelticks(Mouse *next, int *pending)
+{
+	int n, b;
+	Mouse m;
+
+	b = mouse->buttons;
+	n = 1;
+	if(*pending)	/* read ahead already; those go first */
+		return n;
+	while(nbrecv(mousectl->c, &m) > 0){
+		if(m.buttons == b){
+			n++;
+			*pending = 0;	/* the release between two ticks */
+		}else if(m.buttons==0 && *pending==0){
+			next[0] = m;
+			*pending = 1;
+		}else{
+			next[(*pending)++] = m;
+			break;
+		}
+	}
+	return n;
+}
+
+/*
+ * Scroll w by n wheel ticks with one redraw per screenful,
+ * as n Kscrolloneup/Kscrollonedown keys would.
+ */
+void
+wheelscroll(Window *w, int but, int n)
+{
+	int nl, m;
+	uint q0;
+
+	nl = n*mousescrollsize(w->maxlines);
+	if(nl <= 0)
+		nl = n;
+	while(nl > 0){
+		m = nl;
+		if(w->maxlines > 0 && m > w->maxlines)
+			m = w->maxlines;
+		nl -= m;
+		if(but & 8)
+			q0 = wbacknl(w, w->org, m);
+		else
+			q0 = w->org+frcharofpt(w, Pt(w->Frame.r.min.x, w->Frame.r.min.y+m*w->font->height));
+		if(q0 == w->org)
+			break;
+		wsetorigin(w, q0, TRUE);
+	}
+	wmflush();
+}
+
 int
 wtopcmp(void *a, void *b)
 {
@@ -693,7 +1217,11 @@ resized(void)
 	Rectangle r;
 	Point o, n;
 	Window *w;
+	vlong t0;
+	uvlong b0;
 
+	t0 = nsec();
+	b0 = drawbytes;
 	if(getwindow(display, Refnone) < 0)
 		error("failed to re-attach window");
 	freescrtemps();
@@ -706,6 +1234,7 @@ resized(void)
 	o = subpt(viewr.max, viewr.min);
 	n = subpt(view->clipr.max, view->clipr.min);
 	qsort(window, nwindow, sizeof(window[0]), wtopcmp);
+	wregn = -1;	/* reordered */
 	for(i=0; i<nwindow; i++){
 		w = window[i];
 		r = rectsubpt(w->i->r, viewr.min);
@@ -721,16 +1250,19 @@ resized(void)
 				break;
 		incref(w);
 		if(j < nhidden){
-			im = allocimage(display, r, screen->chan, 0, DNofill);
+			im = wmimage(r, screen->chan);
 			r = ZR;
 		} else
-			im = allocwindow(wscreen, r, Refbackup, DNofill);
+			im = wmwindow(r, Refbackup);
 		if(im)
-			wsendctlmesg(w, Reshaped, r, im);
+			wmsendctl(w, Reshaped, r, im);
 		wclose(w);
 	}
 	viewr = screen->r;
-	flushimage(display, 1);
+	wmflush();
+	statadd(Sresized, t0);
+	statbytes(Sresized, b0);
+	wmevent("resize %d %d %d %d", viewr.min.x, viewr.min.y, viewr.max.x, viewr.max.y);
 }
 
 int
@@ -766,21 +1298,27 @@ obscured(Window *w, Rectangle r, int i)
 }
 
 void
-button3menu(void)
+menu3items(void)
 {
-	int i, j, n;
+	int i, j, n, o;
+	vlong t0, t1;
 
+	t0 = nsec();
 	n = nhidden;
 	for(i=0; i<nwindow; i++){
 		for(j=0; j<n; j++)
 			if(window[i] == hidden[j])
 				break;
-		if(j == n)
-			if(obscured(window[i], window[i]->screenr, 0)){
+		if(j == n){
+			t1 = nsec();
+			o = obscured(window[i], window[i]->screenr, 0);
+			statadd(Sobscured, t1);
+			if(o){
 				hidden[n++] = window[i];
 				if(n >= nelem(hidden))
 					break;
 			}
+		}
 	}
 	if(n >= nelem(menu3str)-Hidden)
 		n = nelem(menu3str)-Hidden-1;
@@ -792,6 +1330,16 @@ button3menu(void)
 		free(menu3str[i]);
 		menu3str[i] = nil;
 	}
+	/* the time to put the menu up; the rest is the user's */
+	statadd(Smenu3, t0);
+}
+
+void
+button3menu(void)
+{
+	int i;
+
+	menu3items();
 	sweeping = 1;
 	switch(i = menuhit(3, mousectl, &menu3, wscreen)){
 	case -1:
@@ -814,6 +1362,9 @@ button3menu(void)
 	case Tile:
 		tile();
 		break;
+	case Overview:
+		overview();
+		break;
 	case Exit:
 		if(Hidden > Exit){
 			send(exitchan, nil);
@@ -827,6 +1378,175 @@ button3menu(void)
 	sweeping = 0;
 }
 
+/*
+ * Large pastes and sends are fed to the window in chunks from a
+ * thread of their own, so the mouse thread returns at once and the
+ * client can keep up.  Pastes into one window are applied in order.
+ */
+enum
+{
+	Pastechunk	= 4096,		/* runes per insertion */
+	Pastehiwater	= 16384,	/* unread runes before waiting on the client */
+};
+
+typedef struct Pastejob Pastejob;
+struct Pastejob
+{
+	Window	*w;
+	Rune		*r;
+	int		nr;
+	int		send;
+	int		stop;
+	uint		trimmed;	/* runes wtrim has taken off the head since */
+	Pastejob	*next;
+};
+
+Pastejob	*pastejobs;
+
+Pastejob*
+pastefor(Window *w)
+{
+	Pastejob *p;
+
+	for(p=pastejobs; p!=nil; p=p->next)
+		if(p->w == w)
+			return p;
+	return nil;
+}
+
+/* tell w's pastes that n runes have gone from the head */
+void
+pastetrim(Window *w, uint n)
+{
+	Pastejob *p;
+
+	for(p=pastejobs; p!=nil; p=p->next)
+		if(p->w == w)
+			p->trimmed += n;
+}
+
+/* wait our turn and, for sends, for the client to drain its input */
+int
+pastewait(Pastejob *p)
+{
+	Window *w;
+	Timer *t;
+
+	w = p->w;
+	for(;;){
+		if(p->stop || w->deleted)
+			return 0;
+		if(pastefor(w) == p){
+			if(!p->send)
+				return 1;
+			if(w->rawing && w->nraw <= Pastehiwater)
+				return 1;
+			if(!w->rawing && w->nr-w->qh <= Pastehiwater)
+				return 1;
+		}
+		t = timerstart(10);
+		recv(t->c, nil);
+		timerstop(t);
+	}
+}
+
+void
+pastethread(void *v)
+{
+	Pastejob *p, **l;
+	Window *w;
+	uint q0, q, n;
+	int i;
+
+	threadsetname("pastethread");
+	p = v;
+	w = p->w;
+	q0 = q = 0;
+	n = 0;
+	if(pastewait(p) && !p->send){
+		wcut(w);
+		q0 = q = w->q0;
+	}
+	for(i=0; i<p->nr && pastewait(p); i+=n){
+		if(!p->send){
+			/*
+			 * Other threads ran while we waited.  Follow a trim of
+			 * the head; anything else that moved the selection we
+			 * left (typing, a cut, a click) ends the paste.
+			 */
+			q = q>p->trimmed? q-p->trimmed : 0;
+			q0 = q0>p->trimmed? q0-p->trimmed : 0;
+			p->trimmed = 0;
+			if(w->q0!=q || w->q1!=q || q>w->nr)
+				break;
+		}
+		n = p->nr-i;
+		if(n > Pastechunk)
+			n = Pastechunk;
+		if(p->send){
+			if(w->rawing)
+				waddraw(w, p->r+i, n);
+			else
+				winsert(w, p->r+i, n, w->nr);
+			wsetselect(w, w->nr, w->nr);
+			wshow(w, w->nr);
+		}else if(w->rawing && q==w->nr)
+			waddraw(w, p->r+i, n);
+		else{
+			q = winsert(w, p->r+i, n, q)+n;
+			wsetselect(w, q, q);
+		}
+		wmsendctl(w, Wakeup, ZR, nil);
+		wmflush();
+		yield();	/* let the mouse and the window's own thread in */
+	}
+	if(!w->deleted){
+		/* like wpaste, leave the pasted text selected */
+		if(!p->send && q > q0 && q <= w->nr && w->q0==q && w->q1==q)
+			wsetselect(w, q0, q);
+		wscrdraw(w);
+		wmsendctl(w, Wakeup, ZR, nil);
+		wmflush();
+	}
+	for(l=&pastejobs; *l!=p; l=&(*l)->next)
+		;
+	*l = p->next;
+	free(p->r);
+	free(p);
+	wclose(w);
+}
+
+void
+pastestart(Window *w, Rune *r, int nr, int send)
+{
+	Pastejob *p, **l;
+
+	p = emalloc(sizeof(Pastejob));
+	p->r = runemalloc(nr+1);
+	runemove(p->r, r, nr);
+	p->nr = nr;
+	/* Send always ends the input with a newline */
+	if(send && r[nr-1]!='\n' && r[nr-1]!='\004')
+		p->r[p->nr++] = '\n';
+	p->send = send;
+	incref(w);
+	p->w = w;
+	for(l=&pastejobs; *l!=nil; l=&(*l)->next)
+		;
+	*l = p;
+	threadcreate(pastethread, p, STACK);
+}
+
+void
+pastestop(Window *w)
+{
+	Pastejob *p;
+
+	for(p=pastejobs; p!=nil; p=p->next)
+		if(p->w == w)
+			p->stop = 1;
+}
+
 void
 button2menu(Window *w)
 {
@@ -834,6 +1554,10 @@ button2menu(Window *w)
 		menu2str[Scroll] = "noscroll";
 	else
 		menu2str[Scroll] = "scroll";
+	if(pastefor(w) != nil)
+		menu2str[Stop] = "stop";
+	else
+		menu2str[Stop] = nil;
 	switch(menuhit(2, mousectl, &menu2, wscreen)){
 	case Cut:
 		wsnarf(w);
@@ -847,6 +1571,11 @@ button2menu(Window *w)
 
 	case Paste:
 		getsnarf();
+		if(nsnarf > Pastechunk || pastefor(w) != nil){
+			if(nsnarf > 0)
+				pastestart(w, snarf, nsnarf, 0);
+			break;
+		}
 		wpaste(w);
 		wscrdraw(w);
 		break;
@@ -860,6 +1589,10 @@ button2menu(Window *w)
 		wsnarf(w);
 		if(nsnarf == 0)
 			break;
+		if(nsnarf > Pastechunk || pastefor(w) != nil){
+			pastestart(w, snarf, nsnarf, 1);
+			break;
+		}
 		if(w->rawing){
 			waddraw(w, snarf, nsnarf);
 			if(snarf[nsnarf-1]!='\n' && snarf[nsnarf-1]!='\004')
@@ -877,9 +1610,13 @@ button2menu(Window *w)
 		if(w->scrolling ^= 1)
 			wshow(w, w->nr);
 		break;
+
+	case Stop:
+		pastestop(w);
+		break;
 	}
-	wsendctlmesg(w, Wakeup, ZR, nil);
-	flushimage(display, 1);
+	wmsendctl(w, Wakeup, ZR, nil);
+	wmflush();
 }
 
 Point
@@ -898,6 +1635,8 @@ sweep(void)
 	Image *i, *oi;
 	Rectangle r;
 	Point p0, p;
+	vlong t0;
+	uvlong b0;
 
 	i = nil;
 	menuing = TRUE;
@@ -914,26 +1653,45 @@ sweep(void)
 		if(mouse->buttons != 4 && mouse->buttons != 0)
 			break;
 		if(!eqpt(mouse->xy, p)){
+			/* sweep and drag time each step of the outline */
+			t0 = nsec();
+			b0 = drawbytes;
 			p = onscreen(mouse->xy);
 			r = canonrect(Rpt(p0, p));
-			if(Dx(r)>5 && Dy(r)>5){
-				i = allocwindow(wscreen, r, Refnone, DNofill);
-				freeimage(oi);
-				if(i == nil)
-					goto Rescue;
-				oi = i;
-				border(i, r, Selborder, sizecol, ZP);
-				draw(i, insetrect(r, Selborder), cols[BACK], nil, ZP);
-				flushimage(display, 1);
+			if(Dx(r)>5 && Dy(r)>5 && outlinedue()){
+				if(lowbw)
+					drawborder(r, 1);
+				else{
+					i = wmwindow(r, Refnone);
+					freeimage(oi);
+					if(i == nil)
+						goto Rescue;
+					oi = i;
+					border(i, r, Selborder, sizecol, ZP);
+					draw(i, insetrect(r, Selborder), cols[BACK], nil, ZP);
+				}
+				wmflush();
+				statadd(Ssweep, t0);
+				statbytes(Ssweep, b0);
 			}
 		}
 	}
+	if(lowbw){
+		/* r is where the mouse is, not the last outline drawn */
+		drawborder(r, 0);
+		if(mouse->buttons!=0 || Dx(r)<100 || Dy(r)<3*font->height)
+			goto Rescue;
+		if((i = wmwindow(r, Refbackup)) == nil)
+			goto Rescue;
+		cornercursor(input, mouse->xy, 1);
+		goto Return;
+	}
 	if(mouse->buttons != 0)
 		goto Rescue;
 	if(i==nil || Dx(i->r)<100 || Dy(i->r)<3*font->height)
 		goto Rescue;
 	oi = i;
-	i = allocwindow(wscreen, oi->r, Refbackup, DNofill);
+	i = wmwindow(oi->r, Refbackup);
 	freeimage(oi);
 	if(i == nil)
 		goto Rescue;
@@ -953,15 +1711,22 @@ sweep(void)
 	return i;
 }
 
+/*
+ * An edge of the same size is moved rather than made anew, and
+ * one already in place costs nothing; in a drag every step is a
+ * move, and in a sweep only the edges whose length changed are
+ * reallocated.
+ */
 void
 drawedge(Image **bp, Rectangle r)
 {
 	Image *b = *bp;
-	if(b != nil && Dx(b->r) == Dx(r) && Dy(b->r) == Dy(r))
-		originwindow(b, r.min, r.min);
-	else{
+	if(b != nil && Dx(b->r) == Dx(r) && Dy(b->r) == Dy(r)){
+		if(!eqpt(b->r.min, r.min))
+			originwindow(b, r.min, r.min);
+	}else{
 		freeimage(b);
-		b = allocwindow(wscreen, r, Refbackup, DNofill);
+		b = wmwindow(r, Refbackup);
 		if(b != nil) draw(b, r, sizecol, nil, ZP);
 		*bp = b;
 	}
@@ -992,6 +1757,8 @@ drag(Window *w, Rectangle *rp)
 	Image *i, *ni;
 	Point p, op, d, dm, om;
 	Rectangle r;
+	vlong t0;
+	uvlong b0;
 
 	i = w->i;
 	menuing = TRUE;
@@ -1001,23 +1768,29 @@ drag(Window *w, Rectangle *rp)
 	d = subpt(i->r.max, i->r.min);
 	op = subpt(mouse->xy, dm);
 	drawborder(Rect(op.x, op.y, op.x+d.x, op.y+d.y), 1);
-	flushimage(display, 1);
+	wmflush();
 	while(mouse->buttons == 4){
 		p = subpt(mouse->xy, dm);
-		if(!eqpt(p, op)){
+		if(!eqpt(p, op) && outlinedue()){
+			t0 = nsec();
+			b0 = drawbytes;
 			drawborder(Rect(p.x, p.y, p.x+d.x, p.y+d.y), 1);
-			flushimage(display, 1);
+			wmflush();
+			statadd(Sdrag, t0);
+			statbytes(Sdrag, b0);
 			op = p;
 		}
 		readmouse(mousectl);
 	}
+	if(lowbw)
+		op = subpt(mouse->xy, dm);
 	r = Rect(op.x, op.y, op.x+d.x, op.y+d.y);
 	drawborder(r, 0);
 	cornercursor(w, mouse->xy, 1);
 	moveto(mousectl, mouse->xy);	/* force cursor update; ugly */
 	menuing = FALSE;
-	flushimage(display, 1);
-	if(mouse->buttons!=0 || (ni=allocwindow(wscreen, r, Refbackup, DNofill))==nil){
+	wmflush();
+	if(mouse->buttons!=0 || (ni=wmwindow(r, Refbackup))==nil){
 		moveto(mousectl, om);
 		while(mouse->buttons)
 			readmouse(mousectl);
@@ -1114,16 +1887,18 @@ bandsize(Window *w)
 	while(mouse->buttons == but){
 		p = onscreen(mouse->xy);
 		r = whichrect(w->screenr, p, which);
-		if(!eqrect(r, or) && goodrect(r)){
+		if(!eqrect(r, or) && goodrect(r) && outlinedue()){
 			drawborder(r, 1);
-			flushimage(display, 1);
+			wmflush();
 			or = r;
 		}
 		readmouse(mousectl);
 	}
 	p = mouse->xy;
+	if(lowbw && goodrect(r = whichrect(w->screenr, onscreen(p), which)))
+		or = r;
 	drawborder(or, 0);
-	flushimage(display, 1);
+	wmflush();
 	wsetcursor(w, 1);
 	if(mouse->buttons!=0 || Dx(or)<100 || Dy(or)<3*font->height){
 		while(mouse->buttons)
@@ -1132,7 +1907,7 @@ bandsize(Window *w)
 	}
 	if(abs(p.x-startp.x)+abs(p.y-startp.y) <= 1)
 		return nil;
-	return allocwindow(wscreen, or, Refbackup, DNofill);
+	return wmwindow(or, Refbackup);
 }
 
 Window*
@@ -1172,7 +1947,7 @@ delete(void)
 
 	w = pointto(TRUE);
 	if(w)
-		wsendctlmesg(w, Deleted, ZR, nil);
+		wmsendctl(w, Deleted, ZR, nil);
 }
 
 void
@@ -1187,7 +1962,7 @@ resize(void)
 	incref(w);
 	i = sweep();
 	if(i)
-		wsendctlmesg(w, Reshaped, i->r, i);
+		wmsendctl(w, Reshaped, i->r, i);
 	wclose(w);
 }
 
@@ -1204,7 +1979,7 @@ move(void)
 	incref(w);
 	i = drag(w, &r);
 	if(i)
-		wsendctlmesg(w, Moved, r, i);
+		wmsendctl(w, Moved, r, i);
 	cornercursor(w, mouse->xy, 1);
 	wclose(w);
 }
@@ -1221,10 +1996,11 @@ whide(Window *w)
 	if(nhidden >= nelem(hidden))
 		return 0;
 	incref(w);
-	i = allocimage(display, w->screenr, w->i->chan, 0, DNofill);
+	i = wmimage(w->screenr, w->i->chan);
 	if(i){
 		hidden[nhidden++] = w;
-		wsendctlmesg(w, Reshaped, ZR, i);
+		wmevent("hide %d", w->id);
+		wmsendctl(w, Reshaped, ZR, i);
 	}
 	wclose(w);
 	return i!=0;
@@ -1241,12 +2017,23 @@ wunhide(Window *w)
 			break;
 	if(j == nhidden)
 		return -1;	/* not hidden */
+	if(istiled(w)){
+		/*
+		 * back into the grid, not where it was; applylayout
+		 * takes it out of hidden[] once it has a window
+		 */
+		unhiding = w;
+		retile(w);
+		unhiding = nil;
+		return !ishidden(w);
+	}
 	incref(w);
-	i = allocwindow(wscreen, w->i->r, Refbackup, DNofill);
+	i = wmwindow(w->i->r, Refbackup);
 	if(i){
 		--nhidden;
 		memmove(hidden+j, hidden+j+1, (nhidden-j)*sizeof(Window*));
-		wsendctlmesg(w, Reshaped, w->i->r, i);
+		wmevent("unhide %d", w->id);
+		wmsendctl(w, Reshaped, w->i->r, i);
 	}
 	wclose(w);
 	return i!=0;
@@ -1278,35 +2065,65 @@ unhide(int j)
 		return;
 	}
 	/* uncover obscured window */
-	for(j=0; j<nwindow; j++)
-		if(window[j] == w){
-			incref(w);
-			wtopme(w);
-			wcurrent(w);
-			wclose(w);
-			return;
-		}
+	if((j = windex(w->id))>=0 && window[j]==w){
+		incref(w);
+		wtopme(w);
+		wcurrent(w);
+		wclose(w);
+	}
 }
 
 void
 tile(void)
 {
-	Window *w;
-	Image *im;
-	Point o, n;
+	int i;
+
+	if(nregion == 0){
+		tilein(nil);
+		return;
+	}
+	regionclaim();
+	for(i=0; i<nregion; i++)
+		tilein(&regions[i]);
+}
+
+/* lay out the visible windows of region g, or of the screen if nil */
+void
+tilein(Region *g)
+{
+	Window *w, **v;
+	Layout *l;
+	Point o, n, org;
 //  Point canvas;
-	uint i, k, j; 
+	uint i, k; 
 	uint ytiles = 0;
 	uint xtiles = 1;
+	uint nvis;
+	vlong t0;
+	uvlong b0;
 
 	// int s = 0;
 
-	if (nwindow < 1) 
+	/* hidden windows keep their place out of the grid */
+	v = emalloc((nwindow+1)*sizeof(Window*));
+	nvis = 0;
+	if(g == nil){
+		for(i = 0; i < nwindow; i++)
+			if(tileable(window[i]))
+				v[nvis++] = window[i];
+	}else
+		for(i = 0; i < g->nid; i++)
+			if((w = wfindid(g->id[i])) != nil && tileable(w))
+				v[nvis++] = w;
+	if (nvis < 1) 
 	{ 
+		free(v);
 		return; 
 	} 
+	t0 = nsec();
+	b0 = drawbytes;
 
-	for(k = 1; xtiles * ytiles < nwindow; k++) {
+	for(k = 1; xtiles * ytiles < nvis; k++) {
 		switch(k % 2) {
 			case 0:
 				xtiles++;
@@ -1319,6 +2136,11 @@ tile(void)
 
 	o = subpt(viewr.max, viewr.min);
 	n = subpt(view->clipr.max, view->clipr.min);
+	org = screen->clipr.min;
+	if(g != nil){
+		org = regionrect(g).min;
+		o = subpt(regionrect(g).max, org);
+	}
 
 /*
 	unsigned int sw, sh, x, y;
@@ -1395,15 +2217,16 @@ tile(void)
 	}
 	flushimage(display, 1);
 } */
-	for(i = 0; i < nwindow; ++i) {
-		w = window[i];
+	l = emalloc(nvis*sizeof(Layout));
+	for(k = 0; k < nvis; ++k) {
+		w = v[k];
 		Rectangle r;
 		int sw, sh, x, y;
 
 		sw = o.x / xtiles;
 		sh = o.y / ytiles;
-		x = sw * (i % xtiles);
-		y = sh * ((i / xtiles) % ytiles);
+		x = sw * (k % xtiles);
+		y = sh * ((k / xtiles) % ytiles);
 
 		r.min.x = x;
 		r.min.y = y;
@@ -1411,25 +2234,101 @@ tile(void)
 		r.max.x = x + sw; 
 		r.max.y = y + sh; 
 
-		r = rectaddpt(r, screen->clipr.min);
+		r = rectaddpt(r, org);
 
-		for(j = 0; j < nhidden; ++j)
-			if(w == hidden[j])
-				break;
+		l[k].w = w;
+		l[k].r = r;
+		l[k].hide = 0;
+	}
+
+	tiling = TRUE;
+	applylayout(l, k);
+	tiling = FALSE;
+	if(g != nil)
+		g->tiled = TRUE;
+	else
+		tiled = TRUE;
+	free(l);
+	free(v);
+	statadd(Stile, t0);
+	statbytes(Stile, b0);
+}
+
+/*
+ * Put each l[i].w at l[i].r, hidden or not as l[i].hide says,
+ * all as one transaction: the windows get their new images in
+ * order and the screen is flushed once at the end.  A visible
+ * window already in place is left alone.
+ */
+void
+applylayout(Layout *l, int n)
+{
+	Window *w;
+	Image *im;
+	int i, j;
 
+	for(i=0; i<n; i++){
+		w = l[i].w;
+		if(w->deleted || w->i == nil)
+			continue;
+		for(j=0; j<nhidden; j++)
+			if(hidden[j] == w)
+				break;
 		incref(w);
-		if(j < nhidden) {
-			im = allocimage(display, r, screen->chan, 0, DNofill);
-		} else {
-			 im = allocwindow(wscreen, r, Refbackup, DNofill);
+		if(l[i].hide){
+			if(j==nhidden && nhidden>=nelem(hidden)){
+				wclose(w);
+				continue;
+			}
+			if(im = wmimage(l[i].r, w->i->chan)){
+				if(j == nhidden){
+					hidden[nhidden++] = w;
+					wmevent("hide %d", w->id);
+				}
+				wmsendctl(w, Reshaped, ZR, im);
+			}
+		}else if(j<nhidden || !eqrect(l[i].r, w->screenr)){
+			if(im = wmwindow(l[i].r, Refbackup)){
+				if(j < nhidden){
+					--nhidden;
+					memmove(hidden+j, hidden+j+1, (nhidden-j)*sizeof(Window*));
+					wmevent("unhide %d", w->id);
+				}
+				/* only moved: wind.c copies it rather than redrawing */
+				if(lowbw && j==nhidden && Dx(l[i].r)==Dx(w->screenr) && Dy(l[i].r)==Dy(w->screenr))
+					wmsendctl(w, Moved, l[i].r, im);
+				else
+					wmsendctl(w, Reshaped, l[i].r, im);
+			}
 		}
-
-		if(im)
-			wsendctlmesg(w, Reshaped, r, im);
 		wclose(w);
 	}
+	wmflush();
+}
 
-	flushimage(display, 1);
+/*
+ * Load the glyphs of ASCII and Latin-1 into the font's cache before
+ * anyone asks for them.  There is one font and one cache, shared by
+ * every window's frame, so this is done once; it runs when threadmain
+ * first blocks, after the first frame is up.
+ */
+void
+fontwarm(void*)
+{
+	Rune r[256];
+	int i, n;
+	vlong t0;
+
+	threadsetname("fontwarm");
+	t0 = nsec();
+	n = 0;
+	for(i=' '; i<0x7F; i++)
+		r[n++] = i;
+	for(i=0xA0; i<0x100; i++)
+		r[n++] = i;
+	r[n] = 0;
+	runestringwidth(font, r);
+	phases[Pwarm] = nsec()-t0;
 }
 
 Window*
@@ -1439,9 +2338,12 @@ new(Image *i, int hideit, int scrollit, int pid, char *dir, char *cmd, char **ar
 	Mousectl *mc;
 	Channel *cm, *ck, *cctl, *cpid;
 	void **arg;
+	vlong t0, t1;
+	int spawned;
 
 	if(i == nil)
 		return nil;
+	t0 = nsec();
 	if(hideit && nhidden >= nelem(hidden)){
 		freeimage(i);
 		return nil;
@@ -1458,8 +2360,9 @@ new(Image *i, int hideit, int scrollit, int pid, char *dir, char *cmd, char **ar
 	mc->c = cm;
 	w = wmk(i, mc, ck, cctl, scrollit);
 	free(mc);	/* wmk copies *mc */
-	window = erealloc(window, ++nwindow*sizeof(Window*));
-	window[nwindow-1] = w;
+	wregadd(w);
+	if(nregion > 0)
+		regionadd(&regions[curregion], w->id);
 	if(hideit){
 		hidden[nhidden++] = w;
 		w->screenr = ZR;
@@ -1467,6 +2370,7 @@ new(Image *i, int hideit, int scrollit, int pid, char *dir, char *cmd, char **ar
 	threadcreate(winctl, w, 8192);
 	if(!hideit)
 		wcurrent(w);
+	spawned = pid==0;	/* else the client came in through the file server */
 	if(pid == 0){
 		arg = emalloc(5*sizeof(void*));
 		arg[0] = w;
@@ -1477,13 +2381,15 @@ new(Image *i, int hideit, int scrollit, int pid, char *dir, char *cmd, char **ar
 		else
 			arg[3] = argv;
 		arg[4] = dir;
+		t1 = nsec();
 		proccreate(winshell, arg, 8192);
 		pid = recvul(cpid);
+		statadd(Sspawn, t1);
 		free(arg);
 	}
 	if(pid == 0){
 		/* window creation failed */
-		wsendctlmesg(w, Deleted, ZR, nil);
+		wmsendctl(w, Deleted, ZR, nil);
 		chanfree(cpid);
 		return nil;
 	}
@@ -1493,7 +2399,12 @@ new(Image *i, int hideit, int scrollit, int pid, char *dir, char *cmd, char **ar
 		free(w->dir);
 		w->dir = estrdup(dir);
 	}
+	/* -S restores only what rio itself started */
+	if(sessfile && spawned && cmd!=nil)
+		acctcmd(w, cmd, argv? argv : rcargv);
 	chanfree(cpid);
+	statadd(Snew, t0);
+	wmevent("new %d", w->id);
 	return w;
 }
 
@@ -1501,7 +2412,7 @@ static void
 kbdproc(void *arg)
 {
 	Channel *c = arg;
-	char buf[128], *p, *e;
+	char buf[128], *p, *q, *e, *s;
 	int fd, cfd, kfd, n;
 
 	threadsetname("kbdproc");
@@ -1523,8 +2434,10 @@ kbdproc(void *arg)
 		close(fd);
 
 		/* read kbd state */
-		while((n = read(kfd, buf, sizeof(buf))) > 0)
+		while((n = read(kfd, buf, sizeof(buf))) > 0){
+			kbdstamp();
 			chanprint(c, "%.*s", n, buf);
+		}
 		close(kfd);
 	} else {
 		/* read single characters */
@@ -1536,13 +2449,16 @@ kbdproc(void *arg)
 			if((n = read(fd, p, e-p)) <= 0)
 				break;
 			e = p + n;
-			while(p < e && fullrune(p, e - p)){
-				p += chartorune(&r, p);
-				if(r)
-					chanprint(c, "c%C", r);
+			/* send every complete rune of this read as one message */
+			for(q = buf; q < e && fullrune(q, e - q); q += chartorune(&r, q))
+				;
+			if(q > buf && (s = kbdrunes(buf, q - buf)) != nil){
+				kbdstamp();
+				if(sendp(c, s) <= 0)
+					free(s);
 			}
-			n = e - p;
-			memmove(buf, p, n);
+			n = e - q;
+			memmove(buf, q, n);
 			p = buf + n;
 		}
 	}
@@ -1552,10 +2468,18 @@ Channel*
 initkbd(void)
 {
 	Channel *c;
-	char *e;
 
 	c = chancreate(sizeof(char*), 16);
 	procrfork(kbdproc, c, STACK, RFCFDG);
+	return c;
+}
+
+/* kbdproc's first message is nil if all is well */
+Channel*
+kbdwait(Channel *c)
+{
+	char *e;
+
 	if(e = recvp(c)){
 		chanfree(c);
 		c = nil;
@@ -1564,3 +2488,2020 @@ initkbd(void)
 	}
 	return c;
 }
+
+/*
+ * Counters and latency histograms for /dev/wmstats.  Everything
+ * counted here runs in threads of rio's main proc, which never
+ * preempt one another, so updating a counter is a plain add with
+ * no locking; the work of aggregating them is done by the reader.
+ */
+enum
+{
+	Nbucket	= 16,	/* log2 µs: <1µs, <2µs, <4µs, ... ≥16ms */
+};
+
+typedef struct Stat Stat;
+struct Stat
+{
+	char		*name;
+	uvlong	n;
+	uvlong	last;	/* n at the previous read, for rates */
+	uvlong	tot;		/* ns */
+	uvlong	max;		/* ns */
+	ulong	hist[Nbucket];
+	uvlong	bytes;	/* flushed to the draw server */
+};
+
+Stat	stats[NSTAT] = {
+ [Stile]		{"tile"},
+ [Sresized]		{"resized"},
+ [Smenu3]		{"button3menu"},
+ [Sobscured]	{"obscured"},
+ [Ssweep]		{"sweep"},
+ [Sdrag]		{"drag"},
+ [Snew]		{"new"},
+ [Sspawn]		{"spawn"},
+ [Sflush]		{"flush"},
+ [Sallocwindow]	{"allocwindow"},
+ [Sallocimage]	{"allocimage"},
+ [Smouse]		{"mouse"},
+ [Skbd]		{"kbd"},
+ [Skbdqueue]	{"kbdqueue"},
+ [Skbdsend]	{"kbdsend"},
+ [Smousesend]	{"mousesend"},
+ [Srestore]	{"restore"},
+};
+
+char *phasename[NPHASE] = {
+ [Pfont]	"font",
+ [Pdraw]	"draw",
+ [Picons]	"icons",
+ [Pmouse]	"mouse",
+ [Pscreen]	"screen",
+ [Pkbd]	"kbd",
+ [Pfsys]	"fsys",
+ [Pwarm]	"warm",
+};
+
+void
+phase(int p)
+{
+	vlong now;
+
+	now = nsec();
+	phases[p] = now-phaset;
+	phaset = now;
+}
+
+/* record one event of stat s that began at t0; t0 0 just counts it */
+void
+statadd(int s, vlong t0)
+{
+	Stat *st;
+	uvlong d;
+	int b;
+
+	st = &stats[s];
+	st->n++;
+	if(t0 == 0)
+		return;
+	trace(st->name, t0, -1, -1);
+	d = nsec()-t0;
+	st->tot += d;
+	if(d > st->max)
+		st->max = d;
+	for(b=0, d/=1000; d!=0 && b<Nbucket-1; d>>=1)
+		b++;
+	st->hist[b]++;
+}
+
+/* add what's been flushed since b0 to s */
+void
+statbytes(int s, uvlong b0)
+{
+	stats[s].bytes += drawbytes-b0;
+}
+
+/*
+ * In -L, outlines follow the mouse at most every Outlinems, so a
+ * fast drag over a slow link costs a few flushes a second instead
+ * of one per mouse event.
+ */
+enum
+{
+	Outlinems	= 50,
+};
+
+int
+outlinedue(void)
+{
+	static vlong last;
+	vlong now;
+
+	if(!lowbw)
+		return 1;
+	now = nsec();
+	if(now-last < Outlinems*1000000LL)
+		return 0;
+	last = now;
+	return 1;
+}
+
+/*
+ * drawbytes misses what libdraw flushes on its own when its buffer
+ * fills, so it's a lower bound.
+ */
+void
+wmflush(void)
+{
+	vlong t0;
+
+	focuscheck();
+	drawbytes += display->bufp-display->buf;
+	t0 = nsec();
+	flushimage(display, 1);
+	statadd(Sflush, t0);
+}
+
+/*
+ * Arrival times of the messages in kbdchan, in the same order.
+ * Senders stamp just before sending and keyboardthread takes a
+ * stamp per message; if the ring ever overflows the pairing is
+ * off until kbdchan next drains, and those samples are skipped.
+ */
+Lock	kbdtlock;
+vlong	kbdt[256];
+uint	kbdtw, kbdtr;
+
+void
+kbdstamp(void)
+{
+	lock(&kbdtlock);
+	if(kbdtw-kbdtr < nelem(kbdt))
+		kbdt[kbdtw++%nelem(kbdt)] = nsec();
+	unlock(&kbdtlock);
+}
+
+vlong
+kbdunstamp(void)
+{
+	vlong t;
+
+	t = 0;
+	lock(&kbdtlock);
+	if(kbdtr != kbdtw)
+		t = kbdt[kbdtr++%nelem(kbdt)];
+	unlock(&kbdtlock);
+	return t;
+}
+
+/* upper bound in µs of the bucket holding quantile q% of st */
+uvlong
+statq(Stat *st, int q)
+{
+	uvlong n, c;
+	int b;
+
+	c = 0;
+	n = 0;
+	for(b=0; b<Nbucket; b++)
+		n += st->hist[b];
+	if(n == 0)
+		return 0;
+	for(b=0; b<Nbucket-1; b++){
+		c += st->hist[b];
+		if(c*100 >= n*q)
+			break;
+	}
+	return 1ULL<<b;
+}
+
+/*
+ * One line per counter: name, count, count per second since
+ * the last read, mean, p50, p99 and max µs, then the histogram
+ * buckets.  The percentiles are bucket bounds, so powers of two.
+ */
+char*
+wmstats(int *np)
+{
+	Fmt f;
+	Stat *st;
+	vlong now, dt;
+	char *s;
+	int i, j;
+
+	fmtstrinit(&f);
+	now = nsec();
+	dt = now-statread;
+	if(dt <= 0)
+		dt = 1;
+	for(i=0; i<NSTAT; i++){
+		st = &stats[i];
+		fmtprint(&f, "%-11s %11llud %9llud/s %9llud %9llud %9llud %9llud",
+			st->name, st->n, (st->n-st->last)*1000000000ULL/dt,
+			st->n? st->tot/st->n/1000 : 0,
+			statq(st, 50), statq(st, 99), st->max/1000);
+		for(j=0; j<Nbucket; j++)
+			fmtprint(&f, " %lud", st->hist[j]);
+		fmtprint(&f, "\n");
+		st->last = st->n;
+	}
+	fmtprint(&f, "%-11s %11lud hit %9lud miss\n", "thumb", thumbhit, thumbmiss);
+	fmtprint(&f, "%-11s %11llud", "bytes", drawbytes);
+	for(i=0; i<NSTAT; i++)
+		if(stats[i].bytes)
+			fmtprint(&f, " %s %llud %llud/op", stats[i].name, stats[i].bytes,
+				stats[i].n? stats[i].bytes/stats[i].n : 0);
+	fmtprint(&f, "\n");
+	fmtprint(&f, "%-11s", "startup");
+	for(i=0; i<NPHASE; i++)
+		fmtprint(&f, " %s %lld", phasename[i], phases[i]/1000);
+	fmtprint(&f, " firstframe %lld ready %lld\n",
+		(phases[Pfont]+phases[Pdraw]+phases[Picons]+phases[Pmouse]+phases[Pscreen])/1000,
+		(phaset-startt)/1000);
+	statread = now;
+	s = fmtstrflush(&f);
+	if(s == nil)
+		error("wmstats: out of memory");
+	*np = strlen(s);
+	return s;
+}
+
+/*
+ * Span tracing for /dev/wmtrace, off unless switched on by writing
+ * "on" to it or by -t, which also writes the ring to a file when rio
+ * exits.  Spans go in a fixed ring; a writer claims its slot with
+ * ainc and never waits, the oldest spans being overwritten.
+ * When tracing is off the cost is a test of tracing per span.
+ */
+enum
+{
+	Ntrace	= 8192,
+};
+
+typedef struct Trace Trace;
+struct Trace
+{
+	char		*name;
+	vlong	t0;
+	vlong	t1;
+	int		id;		/* window, or -1 */
+	int		queued;	/* Wctlmesgs ahead of this one, or -1 */
+};
+
+Trace	traces[Ntrace];
+long	ntrace;
+int	tracing;
+
+char *ctlname[] = {
+ [Wakeup]		"Wakeup",
+ [Reshaped]		"Reshaped",
+ [Moved]		"Moved",
+ [Refresh]		"Refresh",
+ [Movemouse]	"Movemouse",
+ [Rawon]		"Rawon",
+ [Rawoff]		"Rawoff",
+ [Holdon]		"Holdon",
+ [Holdoff]		"Holdoff",
+ [Deleted]		"Deleted",
+ [Exited]		"Exited",
+};
+
+vlong
+tracestart(void)
+{
+	if(!tracing)
+		return 0;
+	return nsec();
+}
+
+void
+trace(char *name, vlong t0, int id, int queued)
+{
+	Trace *t;
+
+	if(!tracing || t0 == 0)
+		return;
+	/* unsigned, so the count can wrap */
+	t = &traces[(ulong)(ainc(&ntrace)-1)%Ntrace];
+	t->name = name;
+	t->t0 = t0;
+	t->t1 = nsec();
+	t->id = id;
+	t->queued = queued;
+}
+
+/*
+ * Every window and off-screen image rio asks for, timed.  They are
+ * not pooled: the images retiles and hiding replace are freed by
+ * wind.c when it handles Reshaped, so rio never gets them back.
+ */
+Image*
+wmwindow(Rectangle r, int ref)
+{
+	Image *i;
+	vlong t0;
+
+	t0 = nsec();
+	i = allocwindow(wscreen, r, ref, DNofill);
+	statadd(Sallocwindow, t0);
+	return i;
+}
+
+Image*
+wmimage(Rectangle r, ulong chan)
+{
+	Image *i;
+	vlong t0;
+
+	t0 = nsec();
+	i = allocimage(display, r, chan, 0, DNofill);
+	statadd(Sallocimage, t0);
+	return i;
+}
+
+/* the span covers any wait for room in w's Wctlmesg queue */
+void
+wmsendctl(Window *w, int type, Rectangle r, Image *i)
+{
+	vlong t0;
+	int id, q;
+
+	t0 = tracestart();
+	id = w->id;
+	q = w->cctl->n;
+	wacct(w, type);
+	switch(type){
+	case Deleted:
+		wmevent("delete %d", id);
+		break;
+	case Reshaped:
+	case Moved:
+		/* placed by hand or by a client: no longer a tiling */
+		if(Dx(r)!=0 && !tiling)
+			untile(w);
+		if(Dx(r) != 0)
+			wmevent("%s %d %d %d %d %d", type==Moved? "move" : "reshape",
+				id, r.min.x, r.min.y, r.max.x, r.max.y);
+		break;
+	}
+	wsendctlmesg(w, type, r, i);
+	if(t0)
+		trace(type>=0 && type<nelem(ctlname) && ctlname[type]? ctlname[type] : "wsendctlmesg", t0, id, q);
+}
+
+/*
+ * The ring as Chrome/Perfetto trace event JSON,
+ * oldest span first, times in µs.
+ */
+char*
+wmtrace(int *np)
+{
+	Fmt f;
+	Trace *t;
+	ulong i, n;
+	char *s, *sep;
+	int pid;
+
+	fmtstrinit(&f);
+	pid = getpid();
+	n = (ulong)ntrace;
+	i = 0;
+	if(n > Ntrace)
+		i = n-Ntrace;
+	fmtprint(&f, "{\"traceEvents\":[");
+	sep = "\n";
+	for(; i<n; i++){
+		t = &traces[i%Ntrace];
+		if(t->name == nil)
+			continue;
+		fmtprint(&f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":0,\"ts\":%lld,\"dur\":%lld",
+			sep, t->name, pid, t->t0/1000, (t->t1-t->t0)/1000);
+		if(t->id >= 0)
+			fmtprint(&f, ",\"args\":{\"win\":%d,\"queued\":%d}", t->id, t->queued);
+		fmtprint(&f, "}");
+		sep = ",\n";
+	}
+	fmtprint(&f, "\n]}\n");
+	s = fmtstrflush(&f);
+	if(s == nil)
+		error("wmtrace: out of memory");
+	*np = strlen(s);
+	return s;
+}
+
+/* for -t: write the ring to tracefile on the way out */
+void
+wmtracedump(void)
+{
+	char *s;
+	int fd, n;
+
+	if(tracefile == nil)
+		return;
+	if((fd = create(tracefile, OWRITE, 0666)) < 0){
+		fprint(2, "rio: can't create %s: %r\n", tracefile);
+		return;
+	}
+	s = wmtrace(&n);
+	write(fd, s, n);
+	free(s);
+	close(fd);
+}
+
+/* handle a write to /dev/wmtrace; returns an error string or nil */
+char*
+wmtracectl(char *s)
+{
+	if(strncmp(s, "on", 2) == 0)
+		tracing = 1;
+	else if(strncmp(s, "off", 3) == 0)
+		tracing = 0;
+	else if(strncmp(s, "clear", 5) == 0){
+		memset(traces, 0, sizeof traces);
+		ntrace = 0;
+	}else
+		return "bad wmtrace request";
+	return nil;
+}
+
+/*
+ * Benchmarks of the window manager core, run by -B n against the
+ * live display: at 10, 50, 100, ... up to n windows, time a retile,
+ * a screen resize, preparing menu3, hiding and unhiding, and a full
+ * focus cycle, with the allocwindow, allocimage and flush calls and
+ * the draw bytes each makes.  Throughput of /dev/kbdin, of the snarf
+ * buffer, of appending to a window and of chatty clients is measured
+ * once, first.
+ * Results go to standard output; rio exits when done.
+ * Only rio's side of each operation is timed; the windows repaint
+ * asynchronously in their own threads.
+ */
+char *benchargv[] = { "rc", "-c", "sleep 1000000", nil };
+int benchsizes[] = { 10, 50, 100, 500, 1000, 5000, 10000 };
+
+void
+benchresized(void)
+{
+	resized();
+}
+
+void
+benchhide(void)
+{
+	int i, n;
+	Window *w[nelem(hidden)];
+
+	n = 0;
+	for(i=0; i<nwindow && n<nelem(w); i++)
+		if(whide(window[i]) > 0)
+			w[n++] = window[i];
+	for(i=0; i<n; i++)
+		wunhide(w[i]);
+	wmflush();
+}
+
+void
+benchfocus(void)
+{
+	int i, n;
+
+	n = nwindow;
+	for(i=0; i<n; i++)
+		movewindowforward();
+	wmflush();
+}
+
+void
+benchop(char *name, void (*f)(void))
+{
+	uvlong nw, ni, nf, nb;
+	vlong t0;
+
+	nw = stats[Sallocwindow].n;
+	ni = stats[Sallocimage].n;
+	nf = stats[Sflush].n;
+	nb = drawbytes;
+	t0 = nsec();
+	f();
+	t0 = nsec()-t0;
+	print("%-8s %6d windows %10lldµs %6llud allocwindow %6llud allocimage %6llud flush %9llud bytes\n",
+		name, nwindow, t0/1000, stats[Sallocwindow].n-nw,
+		stats[Sallocimage].n-ni, stats[Sflush].n-nf, drawbytes-nb);
+}
+
+/* grow to n windows and run each benchmark there */
+int
+benchat(int n)
+{
+	Rectangle r;
+
+	r = screen->r;
+	r.max.x = r.min.x+300;
+	r.max.y = r.min.y+80;
+	while(nwindow < n)
+		if(new(wmwindow(r, Refbackup), FALSE, scrolling, 0, nil, "/bin/rc", benchargv) == nil){
+			fprint(2, "rio: bench: can't create window %d: %r\n", nwindow);
+			return -1;
+		}
+	benchop("tile", tile);
+	benchop("resize", benchresized);
+	benchop("menu", menu3items);
+	benchop("hide", benchhide);
+	benchop("focus", benchfocus);
+	return 0;
+}
+
+/*
+ * Throughput benchmarks, run once before the others, each in a
+ * window of its own made current for the purpose.
+ */
+Window*
+benchwindow(void)
+{
+	Rectangle r;
+	Window *w;
+
+	r = insetrect(screen->r, Dx(screen->r)/4);
+	w = new(wmwindow(r, Refbackup), FALSE, scrolling, 0, nil, "/bin/rc", benchargv);
+	if(w == nil)
+		fprint(2, "rio: bench: can't create window: %r\n");
+	return w;
+}
+
+/*
+ * /dev/kbdin: n bytes of typing in 8K writes, timed until w has
+ * all of it.  batched sends each write as one message, as
+ * keyboardsend does; otherwise one message per rune, as it used to.
+ */
+vlong
+benchkbdrun(Window *w, char *buf, int n, int batched)
+{
+	vlong t0;
+	int i, j, m;
+
+	if(w->nr > 0)
+		wdelete(w, 0, w->nr);
+	t0 = nsec();
+	for(i=0; i<n; i+=m){
+		m = n-i;
+		if(m > 8192)
+			m = 8192;
+		if(batched)
+			keyboardsend(buf+i, m);
+		else
+			for(j=0; j<m; j++){
+				kbdstamp();
+				chanprint(kbdchan, "c%C", (Rune)buf[i+j]);
+			}
+	}
+	while(w->nr<n && nsec()-t0<60*1000000000LL)
+		yield();
+	return nsec()-t0;
+}
+
+enum
+{
+	Kbdbench	= 256*1024,
+};
+
+void
+benchkbd(void)
+{
+	Window *w;
+	char *buf;
+	vlong t;
+	int i, batched;
+
+	if((w = benchwindow()) == nil)
+		return;
+	buf = emalloc(Kbdbench);
+	for(i=0; i<Kbdbench; i++)
+		buf[i] = i%64==63? '\n' : 'a'+i%26;
+	for(batched=1; batched>=0; batched--){
+		t = benchkbdrun(w, buf, Kbdbench, batched);
+		if(t <= 0)
+			t = 1;
+		print("%-8s %6d runes %10lldµs %10lld runes/s %s\n",
+			"kbdin", w->nr, t/1000, (vlong)w->nr*1000000000LL/t,
+			batched? "batched" : "per-rune");
+	}
+	free(buf);
+	wmsendctl(w, Deleted, ZR, nil);
+}
+
+/*
+ * The snarf buffer at 10MB, 100MB and 1GB: a putsnarf, a getsnarf
+ * that must read it all back and one that the cache should answer.
+ * A size is skipped if the memory for it can't be had or if it is
+ * more than getsnarf can hold, which 1GB of runes is.  The user's
+ * snarf is put back afterwards.
+ */
+void
+benchsnarf(void)
+{
+	static vlong sizes[] = { 10*1024*1024, 100*1024*1024, 1024*1024*1024 };
+	Rune *osnarf;
+	int onsnarf, i, k, n;
+	vlong t0, tput, tget, tcached;
+	void *v;
+
+	if(snarffd < 0)
+		return;
+	getsnarf();
+	osnarf = snarf;
+	onsnarf = nsnarf;
+	snarf = nil;
+	for(k=0; k<nelem(sizes); k++){
+		n = sizes[k];
+		if(n >= Snarfmax){
+			print("%-8s %10d bytes skipped: over %d runes, the most getsnarf can hold\n",
+				"snarf", n, Snarfmax-1);
+			continue;
+		}
+		/* the runes here, then bytes and runes in getsnarf */
+		if((v = malloc(n*(2*sizeof(Rune)+1))) == nil){
+			print("%-8s %10d bytes skipped: no memory\n", "snarf", n);
+			continue;
+		}
+		free(v);
+		snarf = runemalloc(n);
+		for(i=0; i<n; i++)
+			snarf[i] = i%64==63? '\n' : 'a'+i%26;
+		nsnarf = n;
+		t0 = nsec();
+		putsnarf();
+		tput = nsec()-t0;
+		snarfcached = 0;
+		t0 = nsec();
+		getsnarf();
+		tget = nsec()-t0;
+		t0 = nsec();
+		getsnarf();
+		tcached = nsec()-t0;
+		print("%-8s %10d bytes %10lldµs put %10lldµs get %10lldµs cached get\n",
+			"snarf", n, tput/1000, tget/1000, tcached/1000);
+		free(snarf);
+		snarf = nil;
+		nsnarf = 0;
+	}
+	snarf = osnarf;
+	nsnarf = onsnarf;
+	if(nsnarf > 0)
+		putsnarf();
+	else
+		close(open("/dev/snarf", OWRITE|OTRUNC));
+}
+
+/*
+ * 100MB of output appended to one scrolling window, in 64K-rune
+ * writes at the output point as xfidwrite does, held to the -c
+ * cap, or to 1M runes if there is none, by wtrim.
+ */
+enum
+{
+	Appendbench	= 100*1024*1024,
+	Appendchunk	= 64*1024,
+};
+
+void
+benchappend(void)
+{
+	Window *w;
+	Rune *r;
+	vlong t0, t, tmax;
+	int i, osb;
+
+	if((w = benchwindow()) == nil)
+		return;
+	osb = scrollback;
+	if(scrollback == 0)
+		scrollback = 1024*1024;
+	r = runemalloc(Appendchunk);
+	for(i=0; i<Appendchunk; i++)
+		r[i] = i%64==63? '\n' : 'a'+i%26;
+	tmax = 0;
+	t0 = nsec();
+	for(i=0; i<Appendbench; i+=Appendchunk){
+		t = nsec();
+		w->qh = winsert(w, r, Appendchunk, w->qh)+Appendchunk;
+		wshow(w, w->qh);
+		wtrim(w);
+		wmflush();
+		t = nsec()-t;
+		if(t > tmax)
+			tmax = t;
+		yield();
+	}
+	t0 = nsec()-t0;
+	if(t0 <= 0)
+		t0 = 1;
+	print("%-8s %10d runes %10lldµs %8lld KB/s %8lldµs max write, %d runes kept\n",
+		"append", Appendbench, t0/1000, (vlong)Appendbench/1024*1000000000LL/t0,
+		tmax/1000, w->nr);
+	free(r);
+	scrollback = osb;
+	wmsendctl(w, Deleted, ZR, nil);
+}
+
+/*
+ * n chatty windows, each a client writing Chattylines lines as
+ * fast as it can, for n of 1 and of $NPROC: the time until every
+ * client is done, the output rate and how busy that kept rio's main
+ * proc.  Every winctl is a thread of that proc: wind.c relies on
+ * cooperative scheduling to keep winctl, the mouse and keyboard
+ * threads and the menus apart in window[], the frames and the
+ * display buffer.
+ */
+enum
+{
+	Chattylines	= 50000,
+};
+
+/* the loop count is Chattylines */
+char *chattyargv[] = { "rc", "-c", "awk 'BEGIN{for(i=0; i<50000; i++) print \"the quick brown fox jumps over the lazy dog\"}'", nil };
+
+void
+benchchattyrun(int n)
+{
+	Rectangle r;
+	Window *w;
+	Timer *t;
+	char buf[32];
+	int i, live, *pid;
+	long c0;
+	vlong t0;
+
+	pid = emalloc(n*sizeof(int));
+	c0 = proccputime(getpid());
+	t0 = nsec();
+	for(i=0; i<n; i++){
+		r = screen->r;
+		r.min.x += i*Dx(r)/n;
+		r.max.x = r.min.x+Dx(screen->r)/n;
+		if((w = new(wmwindow(r, Refbackup), FALSE, TRUE, 0, nil, "/bin/rc", chattyargv)) == nil){
+			fprint(2, "rio: bench: can't create window: %r\n");
+			break;
+		}
+		pid[i] = w->pid;
+	}
+	n = i;
+	do{
+		t = timerstart(100);
+		recv(t->c, nil);
+		timerstop(t);
+		live = 0;
+		for(i=0; i<n; i++){
+			snprint(buf, sizeof buf, "/proc/%d/status", pid[i]);
+			if(access(buf, AEXIST) == 0)
+				live++;
+		}
+	}while(live>0 && nsec()-t0<120*1000000000LL);
+	t0 = nsec()-t0;
+	print("%-8s %6d windows %10lldµs %8lld KB/s, main proc %3lld%% busy%s\n",
+		"chatty", n, t0/1000, (vlong)n*Chattylines*44/1024*1000000000LL/t0,
+		(vlong)(proccputime(getpid())-c0)*100000000LL/t0,
+		live? ", timed out" : "");
+	free(pid);
+}
+
+void
+benchchatty(void)
+{
+	char *s;
+	int ncpu;
+
+	ncpu = 1;
+	if(s = getenv("NPROC")){
+		ncpu = atoi(s);
+		free(s);
+	}
+	benchchattyrun(1);
+	if(ncpu > 1)
+		benchchattyrun(ncpu);
+}
+
+void
+benchthread(void*)
+{
+	int i;
+
+	threadsetname("benchthread");
+	benchkbd();
+	benchsnarf();
+	benchappend();
+	benchchatty();
+	for(i=0; i<nelem(benchsizes) && benchsizes[i]<benchn; i++)
+		if(benchat(benchsizes[i]) < 0)
+			break;
+	if(i==nelem(benchsizes) || benchsizes[i]>=benchn)
+		benchat(benchn);
+	send(exitchan, nil);
+}
+
+/*
+ * Input recording (-r) and replay (-p at the recorded pace, -P as
+ * fast as possible).  The record is text, one event per line:
+ *	m nsec buttons x y msec
+ *	r nsec
+ *	k nsec nbytes
+ * with a k line followed by the nbytes of the keyboard message.
+ * Mouse events are logged by a relay proc put in front of
+ * mousectl->c, so that events read by sweep, drag and the rest are
+ * caught too; resizes and keyboard messages have one reader each
+ * and are logged there.
+ */
+QLock	reclock;
+
+void
+record(char *fmt, ...)
+{
+	va_list arg;
+	char buf[128], *e;
+
+	if(recfd < 0)
+		return;
+	va_start(arg, fmt);
+	e = vseprint(buf, buf+sizeof buf, fmt, arg);
+	va_end(arg);
+	qlock(&reclock);
+	write(recfd, buf, e-buf);
+	qunlock(&reclock);
+}
+
+void
+recordkbd(char *s)
+{
+	char buf[64];
+	int n, m;
+
+	n = strlen(s);
+	m = snprint(buf, sizeof buf, "k %lld %d\n", nsec(), n);
+	qlock(&reclock);
+	write(recfd, buf, m);
+	write(recfd, s, n);
+	qunlock(&reclock);
+}
+
+void
+recordproc(void *v)
+{
+	Channel **c;
+	Mouse m;
+
+	threadsetname("recordproc");
+	c = v;
+	while(recv(c[0], &m) >= 0){
+		record("m %lld %d %d %d %lud\n", nsec(), m.buttons, m.xy.x, m.xy.y, m.msec);
+		send(c[1], &m);
+	}
+}
+
+void
+recordinit(char *file)
+{
+	static Channel *c[2];
+
+	recfd = create(file, OWRITE|OCEXEC, 0664);
+	if(recfd < 0){
+		fprint(2, "rio: can't create %s: %r\n", file);
+		return;
+	}
+	c[0] = mousectl->c;
+	c[1] = chancreate(sizeof(Mouse), 0);
+	mousectl->c = c[1];
+	proccreate(recordproc, c, STACK);
+}
+
+/*
+ * Feed a record back in through the same channels.  When it
+ * runs out, print the stats for the run and exit.
+ */
+void
+replayproc(void *v)
+{
+	char *file, *buf, *p, *q, *e, *f[6];
+	int fd, n, nf;
+	vlong t, last;
+	Mouse m;
+	Dir *d;
+
+	threadsetname("replayproc");
+	file = v;
+	if((fd = open(file, OREAD)) < 0 || (d = dirfstat(fd)) == nil){
+		fprint(2, "rio: can't open %s: %r\n", file);
+		return;
+	}
+	buf = emalloc(d->length+1);
+	n = readn(fd, buf, d->length);
+	free(d);
+	close(fd);
+	if(n < 0)
+		n = 0;
+	buf[n] = 0;
+	last = 0;
+	for(p=buf, e=buf+n; p<e; p++){
+		if((q = memchr(p, '\n', e-p)) == nil)
+			break;
+		*q = 0;
+		nf = tokenize(p, f, nelem(f));
+		p = q;
+		if(nf < 2)
+			continue;
+		t = strtoll(f[1], nil, 10);
+		if(!replayfast && last != 0 && t > last)
+			sleep((t-last)/1000000);
+		last = t;
+		switch(f[0][0]){
+		case 'm':
+			if(nf < 6)
+				break;
+			m.buttons = atoi(f[2]);
+			m.xy = Pt(atoi(f[3]), atoi(f[4]));
+			m.msec = strtoul(f[5], nil, 10);
+			send(mousectl->c, &m);
+			break;
+		case 'r':
+			sendul(mousectl->resizec, 1);
+			break;
+		case 'k':
+			if(nf < 3 || (n = atoi(f[2])) < 0 || n > e-(p+1))
+				break;
+			kbdstamp();
+			sendp(kbdchan, smprint("%.*s", n, p+1));
+			p += n;
+			break;
+		}
+	}
+	free(buf);
+	buf = wmstats(&n);
+	write(1, buf, n);
+	free(buf);
+	send(exitchan, nil);
+}
+
+/*
+ * Window churn, run by -C n: create and delete n windows in
+ * batches, and report what each window costs at its peak and
+ * what is left behind once they are gone.  Heap is rio's arena,
+ * procs are those still in rio's note group, and images are the
+ * ones rio asked the draw server for (wind.c frees them, so only
+ * the allocation side is visible here).
+ */
+enum
+{
+	Churnbatch	= 100,
+};
+
+typedef struct Usage Usage;
+struct Usage
+{
+	uvlong	heap;
+	int		procs;
+	int		windows;
+	uvlong	images;
+};
+
+int
+countprocs(void)
+{
+	char buf[64], note[32];
+	int fd, i, n, np;
+	Dir *d;
+
+	snprint(buf, sizeof buf, "/proc/%d/noteid", getpid());
+	if((fd = open(buf, OREAD)) < 0)
+		return -1;
+	n = read(fd, note, sizeof note-1);
+	close(fd);
+	if(n <= 0)
+		return -1;
+	note[n] = 0;
+	if((fd = open("/proc", OREAD)) < 0)
+		return -1;
+	n = dirreadall(fd, &d);
+	close(fd);
+	np = 0;
+	for(i=0; i<n; i++){
+		snprint(buf, sizeof buf, "/proc/%s/noteid", d[i].name);
+		if((fd = open(buf, OREAD)) < 0)
+			continue;
+		if(read(fd, buf, sizeof buf) == strlen(note) && memcmp(buf, note, strlen(note)) == 0)
+			np++;
+		close(fd);
+	}
+	free(d);
+	return np;
+}
+
+void
+getusage(Usage *u)
+{
+	u->heap = mainmem->cursize;
+	u->procs = countprocs();
+	u->windows = nwindow;
+	u->images = stats[Sallocwindow].n+stats[Sallocimage].n;
+}
+
+void
+churnthread(void*)
+{
+	Window *w[Churnbatch];
+	Usage u0, ub, u1, u2;
+	Rectangle r;
+	Timer *t;
+	int i, j, n, base, failed;
+	vlong t0;
+
+	threadsetname("churnthread");
+	r = screen->r;
+	r.max.x = r.min.x+300;
+	r.max.y = r.min.y+80;
+	base = nwindow;
+	getusage(&u0);
+	t0 = nsec();
+	for(i=0; i<churnn; i+=n){
+		n = churnn-i;
+		if(n > Churnbatch)
+			n = Churnbatch;
+		/* peaks are of this batch alone, not of what earlier ones left */
+		getusage(&ub);
+		for(j=0; j<n; j++)
+			if((w[j] = new(wmwindow(r, Refbackup), FALSE, scrolling, 0, nil, "/bin/rc", benchargv)) == nil){
+				fprint(2, "rio: churn: can't create window: %r\n");
+				break;
+			}
+		failed = j < n;
+		n = j;
+		getusage(&u1);
+		for(j=0; j<n; j++)
+			wmsendctl(w[j], Deleted, ZR, nil);
+		/* wait, up to 10s, for the batch to be gone */
+		for(j=0; j<1000 && nwindow>base; j++){
+			t = timerstart(10);
+			recv(t->c, nil);
+			timerstop(t);
+		}
+		getusage(&u2);
+		if(n > 0)
+			print("churn %6d: peak %6lld heap/window %5.1f procs/window; after %+lld heap %+d procs %+d windows\n",
+				i+n, (vlong)(u1.heap-ub.heap)/n, (double)(u1.procs-ub.procs)/n,
+				(vlong)(u2.heap-u0.heap), u2.procs-u0.procs, u2.windows-u0.windows);
+		if(failed){
+			i += n;
+			break;
+		}
+	}
+
+	getusage(&u2);
+	print("churn total %d windows in %lldms: %llud images allocated, %+lld heap %+d procs %+d windows left\n",
+		i, (nsec()-t0)/1000000, u2.images-u0.images,
+		(vlong)(u2.heap-u0.heap), u2.procs-u0.procs, u2.windows-u0.windows);
+	send(exitchan, nil);
+}
+
+/*
+ * Per-window accounting, kept beside the Window in a table
+ * hashed on id: the redraws rio has asked of the window, for the
+ * overview's thumbnails, and the command new() started, for -S.
+ * Drawing the client does through /dev/draw never passes through
+ * rio and can't be seen here.
+ */
+enum
+{
+	Nacct	= 64,
+};
+
+typedef struct Acct Acct;
+struct Acct
+{
+	int		id;
+	uvlong	nredraw;	/* Reshaped, Moved or Refresh sent */
+	char		*cmd;	/* quoted command and argv from new(), for -S */
+	Acct		*next;
+};
+
+Acct	*accts[Nacct];
+int	nacct;
+
+Acct*
+acctlook(int id, int create)
+{
+	Acct *a;
+
+	for(a=accts[id%Nacct]; a!=nil; a=a->next)
+		if(a->id == id)
+			return a;
+	if(!create)
+		return nil;
+	/* windows whose clients exit on their own never say so here */
+	if(nacct > 2*nwindow+Nacct)
+		acctprune();
+	a = emalloc(sizeof(Acct));
+	nacct++;
+	a->id = id;
+	a->next = accts[id%Nacct];
+	accts[id%Nacct] = a;
+	return a;
+}
+
+void
+wacct(Window *w, int type)
+{
+	if(type == Deleted){
+		acctdrop(w->id);
+		return;
+	}
+	if(type==Reshaped || type==Moved || type==Refresh)
+		acctlook(w->id, 1)->nredraw++;
+}
+
+Window*
+wfindid(int id)
+{
+	int i;
+
+	if((i = windex(id)) < 0)
+		return nil;
+	return window[i];
+}
+
+void
+acctdrop(int id)
+{
+	Acct *a, **l;
+
+	for(l=&accts[id%Nacct]; (a = *l) != nil; l=&a->next)
+		if(a->id == id){
+			*l = a->next;
+			free(a->cmd);
+			free(a);
+			nacct--;
+			return;
+		}
+}
+
+/* drop the accounts of windows that are gone */
+void
+acctprune(void)
+{
+	Acct *a, **l;
+	int i;
+
+	for(i=0; i<Nacct; i++)
+		for(l=&accts[i]; (a = *l) != nil; )
+			if(wfindid(a->id) == nil){
+				*l = a->next;
+				free(a->cmd);
+				free(a);
+				nacct--;
+			}else
+				l = &a->next;
+}
+
+/* user+sys ms of pid itself, from /proc */
+long
+proccputime(int pid)
+{
+	char buf[256], *f[10];
+	int fd, n;
+
+	snprint(buf, sizeof buf, "/proc/%d/status", pid);
+	if((fd = open(buf, OREAD)) < 0)
+		return -1;
+	n = read(fd, buf, sizeof buf-1);
+	close(fd);
+	if(n <= 0)
+		return -1;
+	buf[n] = 0;
+	/* name user state utime stime ... */
+	if(tokenize(buf, f, nelem(f)) < 5)
+		return -1;
+	return atol(f[3])+atol(f[4]);
+}
+
+int
+ishidden(Window *w)
+{
+	int j;
+
+	for(j=0; j<nhidden; j++)
+		if(hidden[j] == w)
+			return 1;
+	return 0;
+}
+
+/*
+ * The window event stream.  Each reader gets its own bounded
+ * queue of event lines; an event that finds a queue full is
+ * dropped for that reader and counted.  A "drop n" line is
+ * queued ahead of the next event that fits along with it, so it
+ * sits in the stream where the gap is, and a slow reader never
+ * holds up the threads posting events.
+ */
+enum
+{
+	Nevq	= 64,
+};
+
+typedef struct Evreader Evreader;
+struct Evreader
+{
+	Channel	*c;	/* chan(char*)[Nevq] */
+	ulong	drops;
+	int	fd;	/* for -e */
+	Evreader	*next;
+};
+
+Evreader	*evreaders;
+Window	*lastinput;
+
+Evreader*
+wmevopen(void)
+{
+	Evreader *e;
+
+	e = emalloc(sizeof(Evreader));
+	e->c = chancreate(sizeof(char*), Nevq);
+	if(e->c == nil)
+		error("wmevopen: channel alloc failed");
+	e->next = evreaders;
+	evreaders = e;
+	return e;
+}
+
+/* block for the next line; the caller frees it */
+char*
+wmevread(Evreader *e)
+{
+	return recvp(e->c);
+}
+
+/*
+ * -e: one reader, whose lines a proc of its own writes to the
+ * file, so a stalled consumer blocks only that proc and the
+ * events it misses come out as drop lines.
+ */
+void
+evproc(void *v)
+{
+	Evreader *e;
+	char *s;
+	int fd;
+
+	threadsetname("evproc");
+	e = v;
+	fd = e->fd;
+	while((s = wmevread(e)) != nil){
+		if(write(fd, s, strlen(s)) < 0){
+			fprint(2, "rio: %s: %r\n", evfile);
+			free(s);
+			break;
+		}
+		free(s);
+	}
+	close(fd);
+}
+
+void
+evinit(char *file)
+{
+	Evreader *e;
+	int fd;
+
+	if((fd = create(file, OWRITE, 0666)) < 0){
+		fprint(2, "rio: can't create %s: %r\n", file);
+		return;
+	}
+	e = wmevopen();
+	e->fd = fd;
+	proccreate(evproc, e, STACK);
+}
+
+void
+wmevent(char *fmt, ...)
+{
+	Evreader *e;
+	va_list arg;
+	char *s, *t;
+
+	if(evreaders == nil)
+		return;
+	va_start(arg, fmt);
+	s = vsmprint(fmt, arg);
+	va_end(arg);
+	if(s == nil)
+		return;
+	for(e=evreaders; e!=nil; e=e->next){
+		if(e->drops){
+			/* the marker and this event, or neither */
+			if(e->c->n+2 > e->c->s){
+				e->drops++;
+				continue;
+			}
+			if(t = smprint("drop %lud\n", e->drops)){
+				nbsendp(e->c, t);
+				e->drops = 0;
+			}
+		}
+		t = smprint("%s\n", s);
+		if(t==nil || nbsendp(e->c, t) <= 0){
+			free(t);
+			e->drops++;
+		}
+	}
+	free(s);
+}
+
+/* wcurrent lives in wind.c; notice focus changes as they happen */
+void
+focuscheck(void)
+{
+	if(input == lastinput)
+		return;
+	lastinput = input;
+	if(input != nil)
+		wmevent("current %d", input->id);
+	else
+		wmevent("current none");
+}
+
+/*
+ * The window registry.  window[] grows by doubling, and a hash
+ * from window id to index in window[] makes lookup by id O(1).
+ * wind.c compacts window[] when a window goes away, changing
+ * nwindow, so the hash is rebuilt whenever nwindow isn't what it
+ * was built for (wregn) or an entry fails to check out.  Window
+ * ids come from a counter in wmk and are never reused, so they
+ * need no generation tag.  The file server looks windows up with
+ * wlookid in wind.c; wind.patch makes that call wfindid.
+ */
+typedef struct Wslot Wslot;
+struct Wslot
+{
+	int	id;
+	int	idx;		/* in window[]; -1 if empty */
+};
+
+Wslot	*wreg;
+int	nwreg;		/* power of two, at least twice nwindow */
+int	maxwindow;	/* allocated length of window[] */
+
+void
+wregput(int id, int idx)
+{
+	uint h;
+
+	for(h=(uint)id*2654435761U&(nwreg-1); wreg[h].idx>=0; h=(h+1)&(nwreg-1))
+		;
+	wreg[h].id = id;
+	wreg[h].idx = idx;
+}
+
+void
+wregbuild(void)
+{
+	int i, n;
+
+	for(n=16; n<2*nwindow; n*=2)
+		;
+	if(n != nwreg){
+		free(wreg);
+		wreg = emalloc(n*sizeof(Wslot));
+		nwreg = n;
+	}
+	for(i=0; i<nwreg; i++)
+		wreg[i].idx = -1;
+	for(i=0; i<nwindow; i++)
+		wregput(window[i]->id, i);
+	wregn = nwindow;
+}
+
+void
+wregadd(Window *w)
+{
+	if(nwindow == maxwindow){
+		maxwindow = maxwindow? 2*maxwindow : 16;
+		window = erealloc(window, maxwindow*sizeof(Window*));
+	}
+	window[nwindow++] = w;
+	if(wregn==nwindow-1 && 2*nwindow<=nwreg){
+		wregput(w->id, nwindow-1);
+		wregn = nwindow;
+	}else
+		wregbuild();
+}
+
+/* index in window[] of the window with this id, or -1 */
+int
+windex(int id)
+{
+	uint h;
+	int i, tries;
+
+	for(tries=0; tries<2; tries++){
+		if(wreg==nil || wregn!=nwindow)
+			wregbuild();
+		for(h=(uint)id*2654435761U&(nwreg-1); wreg[h].idx>=0; h=(h+1)&(nwreg-1))
+			if(wreg[h].id == id)
+				break;
+		if(wreg[h].idx < 0)
+			return -1;
+		i = wreg[h].idx;
+		if(i<nwindow && window[i]->id==id)
+			return i;
+		wregn = -1;	/* stale */
+	}
+	return -1;
+}
+
+/*
+ * Sessions, for -S.  On exit, by Exit or by the note that usually
+ * ends rio (see shutdown), each window's rectangle, whether it is
+ * hidden, its directory and the command new() started in it are
+ * written to the session file, one window a line from the bottom
+ * of the stack up; at startup the file is read back.  Restore allocates
+ * every image at its saved place before any shell is started, so
+ * nothing needs reshaping afterwards, and runs each new() in a
+ * thread of its own so the shells are forked and exec'd in parallel.
+ * The time until the last one is up is the restore stat.
+ */
+void
+acctcmd(Window *w, char *cmd, char **argv)
+{
+	Acct *a;
+	Fmt f;
+	int i;
+
+	a = acctlook(w->id, 1);
+	fmtstrinit(&f);
+	fmtprint(&f, "%q", cmd);
+	for(i=0; argv[i]; i++)
+		fmtprint(&f, " %q", argv[i]);
+	free(a->cmd);
+	a->cmd = fmtstrflush(&f);
+}
+
+void
+sesssave(char *file)
+{
+	Window **w;
+	Acct *a;
+	Rectangle r;
+	int fd, i;
+
+	if((fd = create(file, OWRITE, 0666)) < 0){
+		fprint(2, "rio: can't create %s: %r\n", file);
+		return;
+	}
+	w = emalloc(nwindow*sizeof(Window*));
+	memmove(w, window, nwindow*sizeof(Window*));
+	qsort(w, nwindow, sizeof(w[0]), wtopcmp);
+	for(i=0; i<nwindow; i++){
+		if(w[i]->deleted || w[i]==wkeyboard)
+			continue;
+		/* not started by rio; restore would have nothing to run */
+		if((a = acctlook(w[i]->id, 0))==nil || a->cmd==nil)
+			continue;
+		r = w[i]->i->r;
+		fprint(fd, "%d %d %d %d %d %q %s\n", r.min.x, r.min.y, r.max.x, r.max.y,
+			ishidden(w[i]), w[i]->dir? w[i]->dir : startdir, a->cmd);
+	}
+	free(w);
+	close(fd);
+}
+
+typedef struct Restore Restore;
+struct Restore
+{
+	Image	*i;
+	int	hide;
+	char	*dir;
+	char	**argv;
+	Window	*w;
+	Channel	*done;
+};
+
+void
+restorewin(void *v)
+{
+	Restore *s;
+
+	threadsetname("restorewin");
+	s = v;
+	s->w = new(s->i, s->hide, scrolling, 0, s->dir, s->argv[0], s->argv+1);
+	sendp(s->done, s);
+}
+
+void
+restorethread(void *v)
+{
+	char *file, *buf, *p, *q, *e, **f;
+	Restore *s;
+	Channel *done;
+	Rectangle r;
+	Window *top;
+	int fd, n, nf, i, ns;
+	vlong t0;
+	Dir *d;
+
+	threadsetname("restorethread");
+	file = v;
+	t0 = nsec();
+	if((fd = open(file, OREAD)) < 0)
+		return;
+	if((d = dirfstat(fd)) == nil){
+		close(fd);
+		return;
+	}
+	buf = emalloc(d->length+1);
+	n = readn(fd, buf, d->length);
+	free(d);
+	close(fd);
+	if(n < 0)
+		n = 0;
+	buf[n] = 0;
+	for(i=0, ns=0; i<n; i++)
+		if(buf[i] == '\n')
+			ns++;
+	s = emalloc(ns*sizeof(Restore));
+	done = chancreate(sizeof(Restore*), ns);
+	ns = 0;
+	for(p=buf, e=buf+n; p<e; p=q+1){
+		if((q = memchr(p, '\n', e-p)) == nil)
+			break;
+		*q = 0;
+		f = emalloc((q-p+1)*sizeof(char*));
+		nf = tokenize(p, f, q-p);
+		if(nf < 8){
+			free(f);
+			continue;
+		}
+		r = Rect(atoi(f[0]), atoi(f[1]), atoi(f[2]), atoi(f[3]));
+		s[ns].hide = atoi(f[4]);
+		if(!s[ns].hide && !goodrect(r)){
+			free(f);
+			continue;
+		}
+		/* allocated now, in order, so the stack comes out as saved */
+		if(s[ns].hide)
+			s[ns].i = wmimage(r, screen->chan);
+		else
+			s[ns].i = wmwindow(r, Refbackup);
+		if(s[ns].i == nil){
+			free(f);
+			continue;
+		}
+		f[nf] = nil;
+		s[ns].dir = f[5];
+		s[ns].argv = f+6;
+		s[ns].done = done;
+		threadcreate(restorewin, &s[ns], STACK);
+		ns++;
+	}
+	top = nil;
+	for(i=0; i<ns; i++)
+		recvp(done);
+	for(i=0; i<ns; i++){
+		if(s[i].w!=nil && !s[i].hide)
+			top = s[i].w;
+		free(s[i].argv-6);
+	}
+	if(top)
+		wcurrent(top);
+	wmflush();
+	statadd(Srestore, t0);
+	wmevent("restore %d", ns);
+	chanfree(done);
+	free(s);
+	free(buf);
+}
+
+/*
+ * The overview: a thumbnail of every window, hidden ones too, in a
+ * grid over the screen; pick one with button 1 or with the arrow
+ * keys and return.  Thumbnails are kept between overviews and only
+ * remade for windows whose signature (image, text and redraw count)
+ * has changed, so putting the overview up reads back the pixels of
+ * the windows that have changed and no others.  Windows whose
+ * client draws for itself give no sign of it here and are always
+ * remade.
+ */
+typedef struct Thumb Thumb;
+struct Thumb
+{
+	int	id;
+	ulong	sig;
+	Image	*i;
+};
+
+Thumb	*thumbs;
+int	nthumb;
+
+ulong
+thumbsig(Window *w)
+{
+	Acct *a;
+	ulong h;
+
+	h = (ulong)(uintptr)w->i;
+	h = h*31 + w->i->r.min.x;
+	h = h*31 + w->i->r.min.y;
+	h = h*31 + w->i->r.max.x;
+	h = h*31 + w->i->r.max.y;
+	h = h*31 + w->nr;
+	h = h*31 + w->org;
+	h = h*31 + w->q0;
+	h = h*31 + w->q1;
+	h = h*31 + w->qh;
+	if(a = acctlook(w->id, 0))
+		h = h*31 + a->nredraw;
+	return h;
+}
+
+/* nearest-neighbour downscale of src to a tw×th XRGB32 image */
+Image*
+thumbmake(Image *src, int tw, int th)
+{
+	Image *tmp, *t;
+	uchar *row, *buf;
+	Rectangle r;
+	int x, y, sw, sh;
+
+	r = src->r;
+	sw = Dx(r);
+	sh = Dy(r);
+	if(sw<=0 || sh<=0)
+		return nil;
+	t = wmimage(Rect(0, 0, tw, th), XRGB32);
+	if(t == nil)
+		return nil;
+	tmp = wmimage(r, XRGB32);
+	if(tmp == nil){
+		freeimage(t);
+		return nil;
+	}
+	draw(tmp, r, src, nil, r.min);
+	row = emalloc(sw*4);
+	buf = emalloc(tw*th*4);
+	for(y=0; y<th; y++){
+		if(unloadimage(tmp, Rect(r.min.x, r.min.y+y*sh/th, r.max.x, r.min.y+y*sh/th+1), row, sw*4) < 0)
+			break;
+		for(x=0; x<tw; x++)
+			memmove(buf+(y*tw+x)*4, row+(x*sw/tw)*4, 4);
+	}
+	loadimage(t, t->r, buf, tw*th*4);
+	free(buf);
+	free(row);
+	freeimage(tmp);
+	return t;
+}
+
+Thumb*
+thumbget(Window *w, int tw, int th)
+{
+	Thumb *t;
+	ulong sig;
+	int k;
+
+	sig = thumbsig(w);
+	for(k=0; k<nthumb; k++)
+		if(thumbs[k].id == w->id)
+			break;
+	if(k == nthumb){
+		thumbs = erealloc(thumbs, ++nthumb*sizeof(Thumb));
+		thumbs[k].id = w->id;
+		thumbs[k].i = nil;
+	}
+	t = &thumbs[k];
+	if(t->i!=nil && t->sig==sig && !w->mouseopen
+	&& Dx(t->i->r)==tw && Dy(t->i->r)==th){
+		thumbhit++;
+		return t;
+	}
+	thumbmiss++;
+	freeimage(t->i);
+	t->i = thumbmake(w->i, tw, th);
+	t->sig = sig;
+	return t;
+}
+
+/* forget the thumbnails of windows that are gone */
+void
+thumbprune(void)
+{
+	int k;
+
+	for(k=0; k<nthumb; )
+		if(wfindid(thumbs[k].id) == nil){
+			freeimage(thumbs[k].i);
+			thumbs[k] = thumbs[--nthumb];
+		}else
+			k++;
+}
+
+Rectangle
+ovcell(int k, int ncol, Point d)
+{
+	Point p;
+
+	p = addpt(view->r.min, Pt((k%ncol)*d.x, (k/ncol)*d.y));
+	return Rpt(p, addpt(p, d));
+}
+
+void
+ovdraw(Image *ov, Window **w, int n, int ncol, Point d, int sel)
+{
+	Rectangle c, r;
+	Thumb *t;
+	int k, tw, th;
+
+	draw(ov, ov->r, background, nil, ZP);
+	for(k=0; k<n; k++){
+		/* deleted while the overview was up */
+		if(w[k]->deleted || w[k]->i==nil)
+			continue;
+		c = insetrect(ovcell(k, ncol, d), 2*Selborder);
+		c.max.y -= font->height;
+		if(Dx(c)<=0 || Dy(c)<=0)
+			continue;
+		/* keep the window's shape */
+		tw = Dx(c);
+		th = Dy(w[k]->i->r)*tw/Dx(w[k]->i->r);
+		if(th > Dy(c)){
+			th = Dy(c);
+			tw = Dx(w[k]->i->r)*th/Dy(w[k]->i->r);
+		}
+		if(tw<=0 || th<=0)
+			continue;
+		t = thumbget(w[k], tw, th);
+		r = rectaddpt(Rect(0, 0, tw, th), c.min);
+		if(t->i)
+			draw(ov, r, t->i, nil, ZP);
+		if(k == sel)
+			border(ov, insetrect(r, -Selborder), Selborder, sizecol, ZP);
+		replclipr(ov, 0, Rect(c.min.x, c.max.y, c.max.x, c.max.y+font->height));
+		string(ov, Pt(c.min.x, c.max.y), display->black, ZP, font,
+			w[k]->label? w[k]->label : "");
+		replclipr(ov, 0, ov->r);
+	}
+	wmflush();
+}
+
+void
+overview(void)
+{
+	Window **w, *pick;
+	Image *ov;
+	Point d;
+	Mouse m;
+	Rune r;
+	char *s;
+	int i, n, ncol, nrow, sel, done;
+	Alt a[3];
+
+	thumbprune();
+	w = emalloc(nwindow*sizeof(Window*));
+	n = 0;
+	for(i=0; i<nwindow; i++)
+		if(!window[i]->deleted && window[i]->i!=nil){
+			/* held until the end; one may be deleted meanwhile */
+			incref(window[i]);
+			w[n++] = window[i];
+		}
+	if(n == 0 || (ov = wmwindow(view->r, Refnone)) == nil){
+		for(i=0; i<n; i++)
+			wclose(w[i]);
+		free(w);
+		return;
+	}
+	for(ncol=1; ncol*ncol<n; ncol++)
+		;
+	nrow = (n+ncol-1)/ncol;
+	d = Pt(Dx(view->r)/ncol, Dy(view->r)/nrow);
+	sel = 0;
+	for(i=0; i<n; i++)
+		if(w[i] == input)
+			sel = i;
+	menuing = TRUE;
+	riosetcursor(nil, 1);
+	overviewc = chancreate(sizeof(char*), 8);
+	ovdraw(ov, w, n, ncol, d, sel);
+	while(mouse->buttons)
+		readmouse(mousectl);
+
+	a[0].c = mousectl->c;
+	a[0].v = &m;
+	a[0].op = CHANRCV;
+	a[1].c = overviewc;
+	a[1].v = &s;
+	a[1].op = CHANRCV;
+	a[2].op = CHANEND;
+	pick = nil;
+	for(done=0; !done; ){
+		switch(alt(a)){
+		case 0:
+			mousectl->Mouse = m;
+			if(m.buttons == 0)
+				break;
+			done = 1;
+			if(m.buttons == 1)
+				for(i=0; i<n; i++)
+					if(ptinrect(m.xy, ovcell(i, ncol, d)))
+						pick = w[i];
+			break;
+		case 1:
+			chartorune(&r, s+1);
+			free(s);
+			i = sel;
+			switch(r){
+			case Kleft:	i--; break;
+			case Kright:	i++; break;
+			case Kup:	i -= ncol; break;
+			case Kdown:	i += ncol; break;
+			case '\n':
+				pick = w[sel];
+				/* fall through */
+			case Kesc:
+				done = 1;
+				break;
+			}
+			if(!done && i>=0 && i<n && i!=sel){
+				sel = i;
+				ovdraw(ov, w, n, ncol, d, sel);
+			}
+			break;
+		}
+	}
+	a[1].c = overviewc;
+	overviewc = nil;
+	while(s = nbrecvp(a[1].c))
+		free(s);
+	chanfree(a[1].c);
+	freeimage(ov);
+	while(mouse->buttons)
+		readmouse(mousectl);
+	if(pick!=nil && !pick->deleted && pick->i!=nil){
+		if(ishidden(pick)){
+			wunhide(pick);
+			wcurrent(pick);
+		}else
+			focuswindow(pick);
+	}
+	for(i=0; i<n; i++)
+		wclose(w[i]);
+	free(w);
+	menuing = FALSE;
+	wmflush();
+}
+
+/*
+ * Regions: named parts of the screen, each tiled on its own from
+ * its own list of windows.  New windows join the current region.
+ * Retiling, unhiding into or closing a window of a tiled region
+ * touches only that region's windows.  With no regions the screen
+ * is tiled as a whole, as before.
+ */
+Region*
+regionof(int id)
+{
+	Region *g;
+	int k;
+
+	for(g=regions; g<regions+nregion; g++)
+		for(k=0; k<g->nid; k++)
+			if(g->id[k] == id)
+				return g;
+	return nil;
+}
+
+void
+regionadd(Region *g, int id)
+{
+	g->id = erealloc(g->id, (g->nid+1)*sizeof(int));
+	g->id[g->nid++] = id;
+}
+
+void
+regiondel(Region *g, int id)
+{
+	int k;
+
+	for(k=0; k<g->nid; k++)
+		if(g->id[k] == id){
+			memmove(g->id+k, g->id+k+1, (--g->nid-k)*sizeof(int));
+			return;
+		}
+}
+
+/* put windows from before the regions in the current one */
+void
+regionclaim(void)
+{
+	int i;
+
+	for(i=0; i<nwindow; i++)
+		if(regionof(window[i]->id) == nil)
+			regionadd(&regions[curregion], window[i]->id);
+}
+
+Rectangle
+regionrect(Region *g)
+{
+	Rectangle c, r;
+
+	c = screen->clipr;
+	r.min.x = c.min.x + Dx(c)*g->pct.min.x/100;
+	r.min.y = c.min.y + Dy(c)*g->pct.min.y/100;
+	r.max.x = c.min.x + Dx(c)*g->pct.max.x/100;
+	r.max.y = c.min.y + Dy(c)*g->pct.max.y/100;
+	return r;
+}
+
+int
+tileable(Window *w)
+{
+	return !w->deleted && (w==unhiding || !ishidden(w));
+}
+
+int
+istiled(Window *w)
+{
+	Region *g;
+
+	if(nregion == 0)
+		return tiled;
+	g = regionof(w->id);
+	return g!=nil && g->tiled;
+}
+
+/* retile where w is, and nowhere else */
+void
+retile(Window *w)
+{
+	Region *g;
+
+	if(nregion == 0){
+		tile();
+		return;
+	}
+	if((g = regionof(w->id)) == nil){
+		g = &regions[curregion];
+		regionadd(g, w->id);
+	}
+	tilein(g);
+}
+
+void
+untile(Window *w)
+{
+	Region *g;
+
+	tiled = FALSE;
+	if(g = regionof(w->id))
+		g->tiled = FALSE;
+}
+
+/*
+ * The wctl region command: "region name minx miny maxx maxy"
+ * defines or redefines a region, in percent of the screen, and
+ * makes it current; "region name" makes an existing one current.
+ * A tiled region that is redefined is retiled.
+ * Returns nil or an error string.
+ */
+char*
+wmregion(char *s)
+{
+	char *f[7];
+	Region *g;
+	Rectangle r;
+	int nf, i;
+
+	nf = tokenize(s, f, nelem(f));
+	if(nf<2 || strcmp(f[0], "region")!=0 || (nf!=2 && nf!=6))
+		return "usage: region name [minx miny maxx maxy]";
+	for(i=0; i<nregion; i++)
+		if(strcmp(regions[i].name, f[1]) == 0)
+			break;
+	if(nf == 2){
+		if(i == nregion)
+			return "no such region";
+		curregion = i;
+		return nil;
+	}
+	r = Rect(atoi(f[2]), atoi(f[3]), atoi(f[4]), atoi(f[5]));
+	if(r.min.x<0 || r.min.y<0 || r.max.x>100 || r.max.y>100 || Dx(r)<=0 || Dy(r)<=0)
+		return "bad region rectangle";
+	if(i == nregion){
+		regions = erealloc(regions, (nregion+1)*sizeof(Region));
+		g = &regions[nregion++];
+		memset(g, 0, sizeof *g);
+		g->name = estrdup(f[1]);
+	}
+	g = &regions[i];
+	g->pct = r;
+	curregion = i;
+	if(g->tiled)
+		tilein(g);
+	return nil;
+}